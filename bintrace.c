@@ -0,0 +1,54 @@
+/*
+ * bintrace.c - Encoding and decoding helpers for binary traces
+ */
+#include <string.h>
+
+#include "bintrace.h"
+
+/*
+ * bt_is_binary - Return true if buf starts with a binary trace header
+ *     of the version we understand
+ */
+int bt_is_binary(const void *buf, size_t len)
+{
+    const bt_header_t *hdr = (const bt_header_t *)buf;
+
+    return len >= sizeof(bt_header_t) &&
+	memcmp(hdr->magic, BT_MAGIC, sizeof(hdr->magic)) == 0 &&
+	hdr->version == BT_VERSION;
+}
+
+/*
+ * bt_put_varint - Encode v at buf and return the number of bytes used
+ */
+size_t bt_put_varint(unsigned char *buf, unsigned int v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+	buf[n++] = (unsigned char)(v | 0x80);
+	v >>= 7;
+    }
+    buf[n++] = (unsigned char)v;
+    return n;
+}
+
+/*
+ * bt_get_varint - Decode the varint at p into *v. Returns the address
+ *     after it, or NULL if it runs into end or is too long.
+ */
+const unsigned char *bt_get_varint(const unsigned char *p,
+				   const unsigned char *end, unsigned int *v)
+{
+    unsigned int val = 0;
+    int shift;
+
+    for (shift = 0; shift < 7 * BT_MAXVARINT && p < end; shift += 7) {
+	val |= (unsigned int)(*p & 0x7f) << shift;
+	if ((*p++ & 0x80) == 0) {
+	    *v = val;
+	    return p;
+	}
+    }
+    return NULL;
+}
@@ -0,0 +1,56 @@
+/*
+ * bintrace.h - Compact binary trace format
+ *
+ * A binary trace is a bt_header_t followed by num_ops packed requests.
+ * Each request is one type byte (BT_ALLOC, BT_FREE, BT_REALLOC,
+ * BT_MEMALIGN, BT_CALLOC, BT_ALLOC_BATCH or BT_FREE_BATCH), the block
+ * index as a varint, for BT_MEMALIGN the alignment, for BT_CALLOC the
+ * element count and for the batches the number of blocks as a varint
+ * and, except for the frees, the (element) size as a varint. This is
+ * the order of the fields on a .rep line. A varint stores 7 bits per
+ * byte, least significant group first, with the high bit set on every
+ * byte but the last.
+ * Header fields are stored in the host's byte order.
+ */
+#ifndef __BINTRACE_H_
+#define __BINTRACE_H_
+
+#include <stddef.h>
+
+#define BT_MAGIC    "MMBT"  /* first four bytes of every binary trace */
+#define BT_VERSION  1
+
+#define BT_ALLOC    'a'
+#define BT_FREE     'f'
+#define BT_REALLOC  'r'
+#define BT_MEMALIGN 'm'
+#define BT_CALLOC   'c'
+#define BT_ALLOC_BATCH 'A'
+#define BT_FREE_BATCH  'F'
+
+#define BT_MAXVARINT 5      /* bytes needed for a 32 bit varint */
+
+/* The fields of a .rep header, in the same order */
+typedef struct {
+    char magic[4];          /* BT_MAGIC */
+    unsigned int version;   /* BT_VERSION */
+    unsigned int sugg_heapsize;
+    unsigned int num_ids;
+    unsigned int num_ops;
+    unsigned int weight;
+} bt_header_t;
+
+/* Return true if the len bytes at buf start with a binary trace header */
+int bt_is_binary(const void *buf, size_t len);
+
+/* Encode v at buf, which has room for BT_MAXVARINT bytes; return its length */
+size_t bt_put_varint(unsigned char *buf, unsigned int v);
+
+/*
+ * Decode the varint at p into *v without reading at or past end.
+ * Return the address just after it, or NULL if it is truncated.
+ */
+const unsigned char *bt_get_varint(const unsigned char *p,
+				   const unsigned char *end, unsigned int *v);
+
+#endif /* __BINTRACE_H_ */
@@ -10,20 +10,22 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/times.h>
+#include <time.h>
 #include "clock.h"
 
 
 /******************************************************* 
  * Machine dependent functions 
  *
- * Note: the constants __i386__ and  __alpha
+ * Note: the constants __i386__, __x86_64__ and  __alpha
  * are set by GCC when it calls the C preprocessor
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
  * Pentium versions of start_counter() and get_counter()
+ * (rdtsc works the same way in 64-bit mode)
  *******************************************************/
 
 
@@ -49,6 +51,15 @@ void start_counter()
     access_counter(&cyc_hi, &cyc_lo);
 }
 
+/* Return the current value of the cycle counter. */
+unsigned long long read_counter()
+{
+    unsigned hi, lo;
+
+    access_counter(&hi, &lo);
+    return ((unsigned long long)hi << 32) | lo;
+}
+
 /* Return the number of cycles since the last call to start_counter. */
 double get_counter()
 {
@@ -116,6 +127,11 @@ void start_counter()
     cyc_lo = counter();
 }
 
+unsigned long long read_counter()
+{
+    return counter();
+}
+
 double get_counter()
 {
     unsigned ncyc_hi, ncyc_lo;
@@ -158,6 +174,15 @@ double get_counter()
     printf("Please choose another timing package in config.h.\n");
     exit(1);
 }
+
+/* Without a cycle counter, count nanoseconds of the monotonic clock */
+unsigned long long read_counter()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 #endif
 
 
@@ -57,9 +57,77 @@
 #define ALIGNMENT 8  
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes. Like the arena sizes below it can be
+ * set on the command line, as the libmm.so target does.
  */
+#ifndef MAX_HEAP
 #define MAX_HEAP (200*(1<<20))  /* 200 MB */
+#endif
+
+/*
+ * Maximum number of independent heaps (arenas) in memlib, and the
+ * size of each arena other than the first, which gets MAX_HEAP
+ */
+#ifndef MAX_ARENAS
+#define MAX_ARENAS 8
+#endif
+#ifndef ARENA_HEAP
+#define ARENA_HEAP (64*(1<<20))  /* 64 MB */
+#endif
+
+/*
+ * Total storage of all the arenas, which memlib lays out back to back
+ */
+#define MEM_SPAN ((size_t)MAX_HEAP + (size_t)(MAX_ARENAS-1)*ARENA_HEAP)
+
+/*
+ * Multi-threaded replay (mdriver -p): the largest thread count tried,
+ * and the number of runs of which the fastest is reported
+ */
+#define MT_MAX_THREADS 8
+#define MT_RUNS 3
+
+/*
+ * Default number of requests between samples of the fragmentation
+ * timeline (mdriver -F)
+ */
+#define FRAG_INTERVAL 100
+
+/*
+ * Payload touching (mdriver -T): bytes between the payload bytes that
+ * are written and read, one per cache line
+ */
+#define TOUCH_STRIDE 64
+
+/*
+ * Benchmark mode (mdriver -B): untimed replays of each trace before
+ * the timed ones, the normal quantile of the confidence intervals
+ * (1.96 for 95%), and the least drop in median Kops (relative) and in
+ * util (absolute) that a significant difference from the baseline
+ * (-b) must show to count as a regression
+ */
+#define BENCH_WARMUP 2
+#define BENCH_MAX_RUNS 1000  /* also the most samples read from a baseline */
+#define BENCH_Z 1.96
+#define BENCH_MIN_KOPS 0.02
+#define BENCH_MIN_UTIL 0.005
+
+/*
+ * Size classes of mm.c's segregated free lists, which gensizes turns
+ * into the tables of sizeclass.h. The classes start at CLASS_MIN bytes
+ * (class 0 also takes anything smaller), and each power of two from
+ * there up is cut into CLASS_STEPS classes, none narrower than 8
+ * bytes; blocks of CLASS_TREE_MIN bytes or more go in the tree
+ * instead, so CLASS_TREE_MIN must be at least 32 to hold a tree node's
+ * header, footer and four links. Block sizes up to CLASS_LOOKUP find
+ * their class with one table load, larger ones from their leading zero
+ * count. All but CLASS_LOOKUP are powers of two, and there are at most
+ * 32 classes.
+ */
+#define CLASS_MIN 16
+#define CLASS_STEPS 1
+#define CLASS_TREE_MIN 1024
+#define CLASS_LOOKUP 512
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
@@ -0,0 +1,169 @@
+/*
+ * gensizes.c - Generate sizeclass.h, the size classes of mm.c's
+ *              segregated free lists, from the CLASS_xxx constants in
+ *              config.h
+ *
+ * Usage: gensizes <out.h>
+ *
+ * The classes start at CLASS_MIN; every power of two from there up to
+ * CLASS_TREE_MIN is cut into CLASS_STEPS classes of equal width, or
+ * fewer where that would make them narrower than a doubleword. Class 0
+ * also takes the blocks below CLASS_MIN. Sizes up to CLASS_LOOKUP get
+ * a table entry; above it a class is computed from the position of the
+ * size's most significant bit, which gensizes checks against the
+ * table it would have had.
+ *
+ * The classes are ranges of block sizes, and a block keeps the size
+ * ADJUST_SIZE rounded it to rather than being raised to its class's,
+ * so the one size a class has is its lower bound, sc_class_min.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+
+#define DSIZE 8         /* block sizes are multiples of this, as in mm.c */
+#define TREE_NODE 24    /* header, four 4-byte links and footer of a tree node */
+#define MAX_CLASSES 32  /* bits of mm.c's free_bitmap */
+
+static int nclasses = 0;
+static unsigned int class_min[MAX_CLASSES]; /* smallest size of each class */
+
+static void app_error(const char *msg)
+{
+    fprintf(stderr, "gensizes: %s\n", msg);
+    exit(1);
+}
+
+static int is_pow2(unsigned long x)
+{
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+static int log2_of(unsigned long x)
+{
+    int lg = 0;
+
+    while (x >>= 1)
+	lg++;
+    return lg;
+}
+
+/*
+ * class_of - The class of block size size, by search of class_min
+ */
+static int class_of(unsigned int size)
+{
+    int c;
+
+    for (c = nclasses - 1; c > 0 && size < class_min[c]; c--)
+	;
+    return c;
+}
+
+/*
+ * formula_class - The class of a size above CLASS_LOOKUP as mm.c
+ *    computes it, from lg_base
+ */
+static int formula_class(unsigned int size, int lg_base, int steps_lg)
+{
+    int lg = log2_of(size);
+
+    return lg_base + (lg << steps_lg) +
+	(int)((size >> (lg - steps_lg)) & ((1u << steps_lg) - 1));
+}
+
+int main(int argc, char **argv)
+{
+    FILE *out;
+    unsigned int base, step, size;
+    int steps_lg = log2_of(CLASS_STEPS), lg_base = 0, c, i;
+
+    if (argc != 2) {
+	fprintf(stderr, "Usage: %s <out.h>\n", argv[0]);
+	exit(1);
+    }
+    if (!is_pow2(CLASS_MIN) || !is_pow2(CLASS_STEPS) ||
+	!is_pow2(CLASS_TREE_MIN))
+	app_error("CLASS_MIN, CLASS_STEPS and CLASS_TREE_MIN must be powers of two");
+    if (CLASS_MIN < DSIZE || CLASS_TREE_MIN <= CLASS_MIN)
+	app_error("need DSIZE <= CLASS_MIN < CLASS_TREE_MIN");
+    if (CLASS_TREE_MIN < TREE_NODE)
+	app_error("CLASS_TREE_MIN must be at least 32 to hold a tree node");
+    if (CLASS_LOOKUP % DSIZE != 0 || CLASS_LOOKUP < CLASS_MIN)
+	app_error("CLASS_LOOKUP must be a multiple of DSIZE of at least CLASS_MIN");
+    if (CLASS_LOOKUP < CLASS_TREE_MIN && CLASS_LOOKUP < CLASS_STEPS * DSIZE)
+	app_error("CLASS_LOOKUP must be at least CLASS_STEPS * DSIZE");
+
+    /* The classes, power of two by power of two */
+    for (base = CLASS_MIN; base < CLASS_TREE_MIN; base *= 2) {
+	step = base / CLASS_STEPS < DSIZE ? DSIZE : base / CLASS_STEPS;
+	for (size = base; size < 2*base; size += step) {
+	    if (nclasses == MAX_CLASSES)
+		app_error("more than 32 classes");
+	    class_min[nclasses++] = size;
+	}
+    }
+    class_min[0] = 0;
+
+    /* Above the table every power of two has CLASS_STEPS classes */
+    if (CLASS_LOOKUP < CLASS_TREE_MIN) {
+	int lg = log2_of(CLASS_LOOKUP);
+
+	lg_base = class_of(1u << lg) - (lg << steps_lg);
+	for (size = CLASS_LOOKUP + DSIZE; size < CLASS_TREE_MIN; size += DSIZE)
+	    if (formula_class(size, lg_base, steps_lg) != class_of(size))
+		app_error("the classes above CLASS_LOOKUP are not evenly spaced");
+    }
+
+    if ((out = fopen(argv[1], "w")) == NULL) {
+	perror(argv[1]);
+	exit(1);
+    }
+    fprintf(out,
+	    "/*\n"
+	    " * sizeclass.h - Size classes of mm.c's segregated free lists\n"
+	    " *\n"
+	    " * Generated by gensizes from config.h, with CLASS_MIN %d,\n"
+	    " * CLASS_STEPS %d, CLASS_TREE_MIN %d and CLASS_LOOKUP %d.\n"
+	    " * Do not edit.\n"
+	    " */\n"
+	    "#ifndef __SIZECLASS_H_\n"
+	    "#define __SIZECLASS_H_\n\n",
+	    CLASS_MIN, CLASS_STEPS, CLASS_TREE_MIN, CLASS_LOOKUP);
+    fprintf(out, "#define NUM_CLASSES %d       /* number of segregated free lists */\n",
+	    nclasses);
+    fprintf(out, "#define TREE_MIN    %d    /* smallest block kept in the tree */\n",
+	    CLASS_TREE_MIN);
+    fprintf(out, "#define SC_DSIZE    %d       /* sizes are multiples of this */\n",
+	    DSIZE);
+    fprintf(out, "#define SC_LOOKUP   %d     /* largest size in sc_class_of */\n\n",
+	    CLASS_LOOKUP);
+    fprintf(out,
+	    "/*\n"
+	    " * A size of 2^lg + r bytes above SC_LOOKUP, with r < 2^lg, is in\n"
+	    " * class SC_LG_BASE + lg*2^SC_STEPS_LG + r/2^(lg-SC_STEPS_LG)\n"
+	    " */\n"
+	    "#define SC_STEPS_LG %d\n"
+	    "#define SC_LG_BASE  (%d)\n\n", steps_lg, lg_base);
+
+    fprintf(out, "/* Class of each size up to SC_LOOKUP, by size/SC_DSIZE */\n");
+    fprintf(out, "static const unsigned char sc_class_of[%d] = {",
+	    CLASS_LOOKUP / DSIZE + 1);
+    for (i = 0; i <= CLASS_LOOKUP / DSIZE; i++)
+	fprintf(out, "%s%d%s", i % 16 ? " " : "\n    ", class_of(i * DSIZE),
+		i < CLASS_LOOKUP / DSIZE ? "," : "\n};\n\n");
+
+    fprintf(out, "/* Smallest block of each class; class 0 takes any below class 1 */\n");
+    fprintf(out, "static const unsigned int sc_class_min[NUM_CLASSES] = {");
+    for (c = 0; c < nclasses; c++)
+	fprintf(out, "%s%u%s", c % 8 ? " " : "\n    ", class_min[c],
+		c < nclasses - 1 ? "," : "\n};\n\n");
+    fprintf(out, "#endif /* __SIZECLASS_H_ */\n");
+    if (fclose(out) != 0) {
+	perror(argv[1]);
+	remove(argv[1]);
+	exit(1);
+    }
+    return 0;
+}
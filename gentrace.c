@@ -0,0 +1,445 @@
+/*
+ * gentrace.c - Generate synthetic .rep traces for the malloc driver
+ *
+ * The trace is a random walk driven by a seeded PRNG, so the same
+ * options and seed always produce the same trace. Each step either
+ * allocates a block, reallocates a live block or frees one:
+ *
+ *   - allocation sizes come from the size distribution (-S)
+ *   - which block is freed is decided by the lifetime model (-L)
+ *   - a step reallocates instead with the probability given by -R
+ *   - while the live payload is at or above the peak (-M), the next
+ *     step always frees
+ *
+ * With -L mix, short-lived blocks are freed when their lifetime is up
+ * and steps allocate otherwise, until the peak forces out a long-lived
+ * block.
+ *
+ * After -n steps every block that is still live is freed, so the
+ * trace is balanced like the ones in traces/.
+ *
+ * Usage: gentrace [options] > out.rep, see usage() for the options
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+
+#define MAXLINE 1024
+
+/* Size distributions (-S) */
+typedef enum {SZ_FIXED, SZ_UNIFORM, SZ_LOGNORMAL, SZ_BIMODAL, SZ_HIST} SizeDist;
+
+/* Lifetime models (-L) */
+typedef enum {LT_LIFO, LT_FIFO, LT_RANDOM, LT_MIX} Lifetime;
+
+/* One request of the generated trace */
+typedef struct {
+    char type;          /* 'a', 'r' or 'f' */
+    int index;          /* block id */
+    int size;           /* payload size, for 'a' and 'r' */
+} op_t;
+
+/* A live block */
+typedef struct {
+    int index;          /* its id */
+    int size;           /* its current payload size */
+    int death;          /* LT_MIX: step at which a short-lived one is due */
+} block_t;
+
+/*
+ * Parameters of the size distribution: a fixed size, a uniform range,
+ * lognormal mu and sigma, or two sizes and the probability of the first
+ */
+static SizeDist size_dist = SZ_UNIFORM;
+static double size_a = 1, size_b = 4096, size_p = 0.5;
+
+/* Empirical size histogram (-S hist:<file>), as cumulative weights */
+static int *hist_sizes = NULL;
+static double *hist_cum = NULL;
+static int hist_n = 0;
+
+/* Lifetime model; for LT_MIX the short-lived share and mean lifetime */
+static Lifetime lifetime = LT_RANDOM;
+static double short_share = 0.9;
+static double short_life = 100;
+
+/* Realloc probability and the factor sizes grow by */
+static double realloc_prob = 0.0;
+static double realloc_growth = 1.5;
+
+/* The generated requests */
+static op_t *ops = NULL;
+static int num_ops = 0;
+static int max_ops = 0;
+
+/****************************************************
+ * A small deterministic PRNG (xorshift64*), so that a
+ * seed means the same trace on every platform
+ ****************************************************/
+static unsigned long long rng_state = 88172645463325252ULL;
+
+static void rng_seed(unsigned long long seed)
+{
+    rng_state = seed * 2685821657736338717ULL + 1;
+    if (rng_state == 0)
+	rng_state = 88172645463325252ULL;
+}
+
+static unsigned long long rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+/* A uniform double in [0, 1) */
+static double rng_uniform(void)
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* A standard normal deviate, by the Box-Muller transform */
+static double rng_normal(void)
+{
+    double u1 = 1.0 - rng_uniform();  /* in (0, 1] */
+    double u2 = rng_uniform();
+
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/*
+ * app_error - Report an error and quit
+ */
+static void app_error(const char *msg)
+{
+    fprintf(stderr, "gentrace: %s\n", msg);
+    exit(1);
+}
+
+/*
+ * read_hist - Load an empirical size histogram: one "size weight" pair
+ *     per line
+ */
+static void read_hist(const char *path)
+{
+    FILE *f;
+    int size;
+    double weight, total = 0;
+    int cap = 0;
+
+    if ((f = fopen(path, "r")) == NULL)
+	app_error("could not open the size histogram");
+    while (fscanf(f, "%d %lf", &size, &weight) == 2) {
+	if (size <= 0 || weight < 0)
+	    app_error("bad line in the size histogram");
+	if (hist_n == cap) {
+	    cap = cap ? 2 * cap : 64;
+	    if ((hist_sizes = realloc(hist_sizes, cap * sizeof(int))) == NULL ||
+		(hist_cum = realloc(hist_cum, cap * sizeof(double))) == NULL)
+		app_error("out of memory");
+	}
+	total += weight;
+	hist_sizes[hist_n] = size;
+	hist_cum[hist_n++] = total;
+    }
+    fclose(f);
+    if (hist_n == 0 || total <= 0)
+	app_error("empty size histogram");
+}
+
+/*
+ * parse_size_dist - Interpret the argument of -S
+ */
+static void parse_size_dist(char *arg)
+{
+    if (sscanf(arg, "fixed:%lf", &size_a) == 1)
+	size_dist = SZ_FIXED;
+    else if (sscanf(arg, "uniform:%lf:%lf", &size_a, &size_b) == 2)
+	size_dist = SZ_UNIFORM;
+    else if (sscanf(arg, "lognormal:%lf:%lf", &size_a, &size_b) == 2)
+	size_dist = SZ_LOGNORMAL;
+    else if (sscanf(arg, "bimodal:%lf:%lf:%lf", &size_a, &size_b, &size_p) == 3)
+	size_dist = SZ_BIMODAL;
+    else if (!strncmp(arg, "hist:", 5)) {
+	size_dist = SZ_HIST;
+	read_hist(arg + 5);
+    }
+    else
+	app_error("unknown size distribution");
+}
+
+/*
+ * parse_lifetime - Interpret the argument of -L
+ */
+static void parse_lifetime(char *arg)
+{
+    if (!strcmp(arg, "lifo"))
+	lifetime = LT_LIFO;
+    else if (!strcmp(arg, "fifo"))
+	lifetime = LT_FIFO;
+    else if (!strcmp(arg, "random"))
+	lifetime = LT_RANDOM;
+    else if (sscanf(arg, "mix:%lf:%lf", &short_share, &short_life) == 2)
+	lifetime = LT_MIX;
+    else
+	app_error("unknown lifetime model");
+}
+
+/*
+ * draw_size - Draw an allocation size from the size distribution
+ */
+static int draw_size(void)
+{
+    double size;
+    int lo, hi, mid;
+
+    switch (size_dist) {
+    case SZ_FIXED:
+	size = size_a;
+	break;
+    case SZ_UNIFORM:
+	size = size_a + rng_uniform() * (size_b - size_a + 1);
+	break;
+    case SZ_LOGNORMAL:
+	size = exp(size_a + size_b * rng_normal());
+	break;
+    case SZ_BIMODAL:
+	size = (rng_uniform() < size_p) ? size_a : size_b;
+	break;
+    case SZ_HIST:
+    default:
+	/* Binary search for the first cumulative weight above the draw */
+	size = rng_uniform() * hist_cum[hist_n - 1];
+	lo = 0;
+	hi = hist_n - 1;
+	while (lo < hi) {
+	    mid = (lo + hi) / 2;
+	    if (hist_cum[mid] <= size)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	size = hist_sizes[lo];
+	break;
+    }
+    if (size < 1)
+	return 1;
+    return (size > 0x7fffffff) ? 0x7fffffff : (int)size;
+}
+
+/*
+ * emit - Append a request to the trace
+ */
+static void emit(char type, int index, int size)
+{
+    if (num_ops == max_ops) {
+	max_ops = max_ops ? 2 * max_ops : 4096;
+	if ((ops = realloc(ops, max_ops * sizeof(op_t))) == NULL)
+	    app_error("out of memory");
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].index = index;
+    ops[num_ops].size = size;
+    num_ops++;
+}
+
+/*
+ * due_push, due_pop - The short-lived blocks of LT_MIX, kept in a
+ *     binary min-heap on the step at which they are due
+ */
+static void due_push(block_t *due, int *ndue, block_t b)
+{
+    int i = (*ndue)++;
+
+    while (i > 0 && due[(i - 1) / 2].death > b.death) {
+	due[i] = due[(i - 1) / 2];
+	i = (i - 1) / 2;
+    }
+    due[i] = b;
+}
+
+static block_t due_pop(block_t *due, int *ndue)
+{
+    block_t top = due[0], last = due[--(*ndue)];
+    int i = 0, c;
+
+    while ((c = 2 * i + 1) < *ndue) {
+	if (c + 1 < *ndue && due[c + 1].death < due[c].death)
+	    c++;
+	if (last.death <= due[c].death)
+	    break;
+	due[i] = due[c];
+	i = c;
+    }
+    due[i] = last;
+    return top;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gentrace [-h] [-s <seed>] [-n <steps>] [-M <bytes>] [-S <sizes>]\n");
+    fprintf(stderr, "                [-L <lifetimes>] [-R <prob>:<growth>] [-a <prob>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-s <seed>   Seed of the random walk (default 1).\n");
+    fprintf(stderr, "\t-n <steps>  Number of requests before the final frees (default 10000).\n");
+    fprintf(stderr, "\t-M <bytes>  Peak live payload to stay under (default 1048576).\n");
+    fprintf(stderr, "\t-a <prob>   Probability that a step allocates while under\n");
+    fprintf(stderr, "\t            the peak (default 0.6, unused by -L mix).\n");
+    fprintf(stderr, "\t-S <sizes>  Size distribution: fixed:<n>, uniform:<lo>:<hi>,\n");
+    fprintf(stderr, "\t            lognormal:<mu>:<sigma>, bimodal:<a>:<b>:<prob of a>\n");
+    fprintf(stderr, "\t            or hist:<file> with \"size weight\" lines\n");
+    fprintf(stderr, "\t            (default uniform:1:4096).\n");
+    fprintf(stderr, "\t-L <order>  Which block is freed next: lifo, fifo, random or\n");
+    fprintf(stderr, "\t            mix:<short share>:<mean short lifetime in steps>,\n");
+    fprintf(stderr, "\t            where the rest live until the peak forces them out\n");
+    fprintf(stderr, "\t            (default random).\n");
+    fprintf(stderr, "\t-R <p>:<g>  Reallocate a live block with probability p per\n");
+    fprintf(stderr, "\t            step, growing it by factor g (default 0:1.5).\n");
+    fprintf(stderr, "\t-h          Print this message.\n");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long seed = 1;
+    int steps = 10000;
+    double peak = 1 << 20;
+    double alloc_prob = 0.6;
+    block_t *live, *due, *bp, b;
+    int nlive = 0, head = 0, ndue = 0;
+    int next_id = 0;
+    double live_bytes = 0, max_live = 0;
+    int step, i, v, size;
+    int c;
+
+    while ((c = getopt(argc, argv, "s:n:M:a:S:L:R:h")) != EOF) {
+	switch (c) {
+	case 's':
+	    seed = strtoull(optarg, NULL, 0);
+	    break;
+	case 'n':
+	    steps = atoi(optarg);
+	    break;
+	case 'M':
+	    peak = atof(optarg);
+	    break;
+	case 'a':
+	    alloc_prob = atof(optarg);
+	    break;
+	case 'S':
+	    parse_size_dist(optarg);
+	    break;
+	case 'L':
+	    parse_lifetime(optarg);
+	    break;
+	case 'R':
+	    if (sscanf(optarg, "%lf:%lf", &realloc_prob, &realloc_growth) != 2)
+		app_error("-R takes <prob>:<growth>");
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (steps <= 0 || peak <= 0)
+	app_error("-n and -M must be positive");
+    rng_seed(seed);
+
+    /*
+     * There are at most as many live blocks as allocations. live[] holds
+     * them in allocation order from head on, except that LT_MIX keeps its
+     * short-lived blocks in due[] instead.
+     */
+    if ((live = malloc((steps + 1) * sizeof(block_t))) == NULL ||
+	(due = malloc((steps + 1) * sizeof(block_t))) == NULL)
+	app_error("out of memory");
+
+    for (step = 0; step < steps; step++) {
+	if (nlive + ndue > head && rng_uniform() < realloc_prob) {
+	    /* Grow a random live block */
+	    v = head + (int)(rng_uniform() * (nlive + ndue - head));
+	    bp = (v < nlive) ? &live[v] : &due[v - nlive];
+	    size = (int)(bp->size * realloc_growth);
+	    if (size < 1)
+		size = 1;
+	    live_bytes += size - bp->size;
+	    bp->size = size;
+	    emit('r', bp->index, size);
+	}
+	else if (ndue > 0 && due[0].death <= step) {
+	    /* A short-lived block has reached the end of its life */
+	    b = due_pop(due, &ndue);
+	    emit('f', b.index, 0);
+	    live_bytes -= b.size;
+	}
+	else if (nlive + ndue == head ||
+		 (live_bytes < peak &&
+		  (lifetime == LT_MIX || rng_uniform() < alloc_prob))) {
+	    /* Allocate a new block */
+	    b.index = next_id++;
+	    b.size = draw_size();
+	    live_bytes += b.size;
+	    emit('a', b.index, b.size);
+	    if (lifetime == LT_MIX && rng_uniform() < short_share) {
+		b.death = step + 1 +
+		    (int)(-log(1.0 - rng_uniform()) * short_life);
+		due_push(due, &ndue, b);
+	    }
+	    else
+		live[nlive++] = b;
+	}
+	else if (nlive == head) {
+	    /* Over the peak with only short-lived blocks: free the next due */
+	    b = due_pop(due, &ndue);
+	    emit('f', b.index, 0);
+	    live_bytes -= b.size;
+	}
+	else {
+	    /* Free the block the lifetime model picks */
+	    if (lifetime == LT_LIFO)
+		v = nlive - 1;
+	    else if (lifetime == LT_FIFO)
+		v = head;
+	    else
+		v = head + (int)(rng_uniform() * (nlive - head));
+	    emit('f', live[v].index, 0);
+	    live_bytes -= live[v].size;
+	    if (lifetime == LT_FIFO)
+		head++;
+	    else if (lifetime == LT_LIFO)
+		nlive--;
+	    else
+		live[v] = live[--nlive];
+	}
+	if (live_bytes > max_live)
+	    max_live = live_bytes;
+    }
+
+    /* Free whatever is left, in lifetime order where there is one */
+    while (ndue > 0)
+	emit('f', due_pop(due, &ndue).index, 0);
+    if (lifetime == LT_LIFO)
+	for (i = nlive - 1; i >= head; i--)
+	    emit('f', live[i].index, 0);
+    else
+	for (i = head; i < nlive; i++)
+	    emit('f', live[i].index, 0);
+
+    /* Header: suggested heap size, ids, requests, weight */
+    printf("%.0f\n%d\n%d\n1\n", max_live, next_id, num_ops);
+    for (i = 0; i < num_ops; i++) {
+	if (ops[i].type == 'f')
+	    printf("f %d\n", ops[i].index);
+	else
+	    printf("%c %d %d\n", ops[i].type, ops[i].index, ops[i].size);
+    }
+    free(live);
+    free(due);
+    free(ops);
+    return 0;
+}
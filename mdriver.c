@@ -7,19 +7,34 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE     /* for sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <math.h>
+#include <stdint.h>
 #include <assert.h>
 #include <float.h>
+#include <limits.h>
 #include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
 #include "config.h"
+#include "bintrace.h"
+#include "perfctr.h"
 
 /**********************
  * Constants and macros
@@ -31,32 +46,58 @@
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The records form a treap
+ * ordered by address, so that a block's neighbours are found in
+ * O(log n) expected time however many blocks are live.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    unsigned int prio;     /* random heap priority, highest at the root */
+    struct range_t *left;  /* ranges below lo (next free record if unused) */
+    struct range_t *right; /* ranges above hi */
 } range_t;
 
+/* Range records are carved out of chunks of RANGE_CHUNK at a time */
+#define RANGE_CHUNK 4096
+typedef struct range_chunk_t {
+    struct range_chunk_t *next;     /* previously allocated chunk */
+    range_t ranges[RANGE_CHUNK];
+} range_chunk_t;
+
 /* Characterizes a single trace operation (allocator request) */
-typedef enum {ALLOC, FREE, REALLOC} RequestType;
+typedef enum {ALLOC, FREE, REALLOC, MEMALIGN, CALLOC,
+	      ALLOC_BATCH, FREE_BATCH} RequestType;
+#define NUM_REQTYPES 7
 typedef struct {
     RequestType type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+    int arg;                          /* memalign alignment, calloc */
+                                      /* element count (size is the total) */
+                                      /* or number of blocks in a batch, */
+                                      /* which has indices index..+arg-1 */
 } traceop_t;
 
+/* Names of the request types, as in "mm_<name>" */
+static const char *req_names[NUM_REQTYPES] = 
+    {"malloc", "free", "realloc", "memalign", "calloc",
+     "malloc_batch", "free_batch"};
+
 /* Holds the information for one trace file*/
 typedef struct {
+    char *filename;      /* name of the trace file */
     int sugg_heapsize;   /* suggested heap size (unused) */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
+    int num_reqs;        /* number of blocks they allocate, free or resize */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
@@ -71,8 +112,24 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    struct lathist_t *lat; /* if not NULL, time every request into */
+                           /* lat[type] (see -H) */
+    int touch;             /* if set, touch the payloads (see -T) */
 } speed_t;
 
+/* 
+ * Log-scale histogram of request latencies in cycles. Each power of
+ * two is split into 2^LAT_SUB_BITS buckets, so a percentile read off
+ * the histogram is within 1/2^LAT_SUB_BITS of the true value.
+ */
+#define LAT_SUB_BITS 2
+#define LAT_BUCKETS (64 << LAT_SUB_BITS)
+typedef struct lathist_t {
+    unsigned long count[LAT_BUCKETS]; /* number of samples per bucket */
+    unsigned long n;                  /* total number of samples */
+    unsigned long long max;           /* largest sample */
+} lathist_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -82,10 +139,69 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t peak_heap;  /* largest heap size during the trace (bytes) */
+    size_t final_heap; /* heap size at the end of the trace (bytes) */
+                       /* (both counting the mapped regions) */
+    double touch_secs; /* secs with the payloads touched (-T) */
+    pc_counts_t hw;    /* hardware events of one more replay (-C) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* How mdriver -p spreads a trace over several threads */
+typedef enum {MT_COPY, MT_SPLIT, MT_REMOTE} MtMode;
+
+/* 
+ * Single-producer, single-consumer queue of blocks. In MT_REMOTE mode
+ * a producer thread replays the trace and hands each block it would
+ * free to its consumer thread, which frees it instead.
+ */
+#define MT_RING 1024
+typedef struct {
+    char *slots[MT_RING];
+    unsigned int head;     /* next slot to fill, written by the producer */
+    unsigned int tail;     /* next slot to drain, written by the consumer */
+} mtring_t;
+
+/* Holds the params and results of one replay thread */
+typedef struct {
+    trace_t *trace;        /* the shared, read-only trace */
+    MtMode mode;
+    int id;                /* this thread's number... */
+    int nthreads;          /* ...out of this many */
+    char **blocks;         /* this thread's block pointers, by trace index */
+    mtring_t *ring;        /* MT_REMOTE: queue to/from the partner thread */
+    pthread_barrier_t *start; /* released once all threads are ready */
+    double ops;            /* number of requests this thread performed */
+    double begin, end;     /* and when it started and finished them */
+} mtarg_t;
+
+/* Summarizes a trace replayed on some number of threads at once */
+typedef struct {
+    int threads;     /* number of threads (0 if not run in this mode) */
+    double ops;      /* requests performed by all threads together */
+    double secs;     /* wall clock time of the fastest run */
+    double min_kops; /* slowest and fastest per-thread throughput... */
+    double max_kops; /* ...in that run, in Kops/sec */
+} mtstats_t;
+
+/* 
+ * What main wants to know about each trace: the per-trace result
+ * arrays, filled in by eval_libc_trace or eval_mm_trace. The mm-only
+ * arrays are NULL for libc, and lat and mt are NULL unless -H or -p
+ * asked for them. Under -j, worker processes send these back.
+ */
+typedef struct {
+    char **tracefiles;     /* the traces */
+    stats_t *stats;        /* stats[i] for trace i */
+    mm_stats_t *counters;  /* counters[i]: mm_stats after trace i */
+    lathist_t *lat;        /* lat[i*NUM_REQTYPES + type] */
+    mtstats_t *mt;         /* mt[i*MT_NUMCOUNTS + k] */
+    MtMode mt_mode;        /* how -p spreads the trace over threads */
+} evaljob_t;
+
+typedef void (*eval_funct)(evaljob_t *job, int tracenum);
+
 /********************
  * Global variables
  *******************/
@@ -96,6 +212,28 @@ char msg[MAXLINE];      /* for whenever we need to compose an error message */
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* Fragmentation timeline (-F): where it goes and how often to sample */
+static FILE *frag_file = NULL;
+static int frag_json = 0;              /* write JSON instead of CSV */
+static int frag_interval = FRAG_INTERVAL;
+static int frag_samples = 0;           /* samples written so far */
+
+/* Set by -C: count hardware events during an extra replay */
+static int run_hw = 0;
+
+/* Fraction of each payload that -T writes and reads, 0 without -T */
+static double touch_frac = 0;
+static volatile unsigned char touch_sink; /* keeps the reads alive */
+
+/* The pool of range records */
+static range_chunk_t *range_chunks = NULL; /* all chunks allocated so far */
+static int range_chunk_used = RANGE_CHUNK; /* records used in the newest */
+static range_t *free_ranges = NULL;        /* records given back */
+
+/* Thread counts tried by mdriver -p */
+static const int mt_threads[] = {1, 2, 4, MT_MAX_THREADS};
+#define MT_NUMCOUNTS (int)(sizeof(mt_threads) / sizeof(int))
+
 /* The filenames of the default tracefiles */
 static const char *default_tracefiles[] = {  
     DEFAULT_TRACEFILES, NULL
@@ -106,16 +244,35 @@ static const char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate the range tree */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *find_range(range_t *ranges, char *addr);
+static range_t *insert_range(range_t *t, range_t *p);
+static range_t *delete_range(range_t *t, char *lo);
+static range_t *join_ranges(range_t *l, range_t *r);
+static range_t *new_range(void);
+static void put_range(range_t *p);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static int read_bintrace(char *path, trace_t *trace);
+static void set_arg_op(traceop_t *op, RequestType type, unsigned int arg,
+		       unsigned int size, char *path);
+static void alloc_trace(trace_t *trace);
 static void free_trace(trace_t *trace);
 
+/* Carry out an ALLOC, MEMALIGN or CALLOC request */
+static void *mm_alloc_op(traceop_t *op);
+static void *libc_alloc_op(traceop_t *op);
+
+/* Carry out an ALLOC_BATCH or FREE_BATCH request on blocks[] */
+static int mm_batch_op(traceop_t *op, char **blocks);
+static int libc_batch_op(traceop_t *op, char **blocks);
+static int count_reqs(trace_t *trace);
+
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
@@ -123,11 +280,76 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static void eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			 stats_t *stats, mm_stats_t *counters);
 static void eval_mm_speed(void *ptr);
 
+/* Routines for the benchmark mode (-B) */
+static int eval_bench(char **tracefiles, int num_tracefiles, int runs,
+		      char *json, char *base);
+static int bench_report(char **tracefiles, int num_tracefiles, int runs,
+			int *valid, double *kops, double *util, double *perf,
+			char *base);
+static void bench_json(char *path, char **tracefiles, int num_tracefiles,
+		       int runs, int *valid, double *kops, double *util, 
+		       double *perf);
+static void json_series(FILE *fp, const char *key, double *x, int n,
+			const char *end);
+static void json_string(FILE *fp, const char *s);
+static char *json_find_name(char *text, const char *name);
+static int json_count_names(char *text);
+static int json_samples(char *from, const char *key, double *out, int max);
+static char *read_file(char *path);
+static void median_ci(double *x, int n, double *m);
+static double mann_whitney_z(double *x, int nx, double *y, int ny);
+static double normal_tail(double z);
+
+/* Evaluate one trace for main, and run all of them (-j: in parallel) */
+static void eval_libc_trace(evaljob_t *job, int tracenum);
+static void eval_mm_trace(evaljob_t *job, int tracenum);
+static void run_traces(eval_funct eval, evaljob_t *job, int num_tracefiles,
+		       int njobs);
+static int job_parts(evaljob_t *job, int tracenum, void **parts, 
+		     size_t *sizes);
+static void run_job(eval_funct eval, evaljob_t *job, int tracenum, 
+		    int slot, int fd);
+static int collect_job(evaljob_t *job, int tracenum, int fd);
+static void pin_cpu(int slot);
+
+/* Runs the mm package's traces under each of its placement policies */
+static void eval_policies(char **tracefiles, int num_tracefiles);
+
+/* Routines for measuring how the mm package scales over threads */
+static void eval_mm_threads(trace_t *trace, MtMode mode, int nthreads,
+			    mtstats_t *stats);
+static void *mt_replay(void *ptr);
+static void mt_push(mtring_t *ring, char *p);
+static char *mt_pop(mtring_t *ring);
+static double wall_secs(void);
+
+/* Routines for the per-request latency histograms */
+static void lat_calibrate(void);
+static void lat_record(lathist_t *h, unsigned long long cycles);
+static unsigned long long lat_percentile(lathist_t *h, double p);
+
+/* Routines that touch payloads under -T */
+static size_t touch_len(size_t size);
+static void touch_write(char *p, size_t size);
+static void touch_read(char *p, size_t size);
+
+/* These functions write the fragmentation timeline */
+static void frag_open(char *path);
+static void frag_sample(trace_t *trace, int tracenum, int opnum, 
+			int live_bytes);
+static void frag_close(void);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printmtresults(int n, MtMode mode, mtstats_t *stats);
+static void printlatresults(int n, lathist_t *lat);
+static void printtouchresults(int n, stats_t *stats);
+static void printhwresults(int n, stats_t *stats);
+static void printmmstats(int n, stats_t *stats, mm_stats_t *counters);
 static void usage(void);
 static void unix_error(const char *msg);
 static void malloc_error(int tracenum, int opnum, const char *msg);
@@ -142,15 +364,24 @@ int main(int argc, char **argv)
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
-    trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */ 
+    evaljob_t job;             /* where eval_xx_trace put their results */
+    mtstats_t *mt_stats = NULL;/* mm stats for each trace and thread count */
+    lathist_t *mm_lat = NULL;  /* mm latencies for each trace and op type */
+    mm_stats_t *mm_counters = NULL; /* mm_stats after each trace */
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int run_mt = 0;      /* If set, replay traces on several threads (-p) */
+    MtMode mt_mode = MT_COPY; /* and how to spread them over the threads */
+    int run_lat = 0;     /* If set, histogram request latencies (-H) */
+    int run_policies = 0;/* If set, compare the placement policies (-P) */
+    int njobs = 1;       /* Traces evaluated at once, by workers (-j) */
+    int bench_runs = 0;  /* If set, benchmark this many runs a trace (-B) */
+    char *bench_out = NULL;  /* and write the results here (-J) */
+    char *bench_base = NULL; /* and compare them with these (-b) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -159,7 +390,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:p:F:i:T:j:B:J:b:hvVgalHPC")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -186,6 +417,63 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'F': /* Write a fragmentation timeline to this file */
+            frag_open(optarg);
+            break;
+        case 'i': /* Sample the fragmentation timeline this often */
+            if ((frag_interval = atoi(optarg)) <= 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'T': /* Also time the traces touching the payloads */
+            touch_frac = atof(optarg);
+            if (touch_frac <= 0 || touch_frac > 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'P': /* Compare all placement policies of the mm package */
+            run_policies = 1;
+            break;
+        case 'j': /* Evaluate this many traces at once */
+            if ((njobs = atoi(optarg)) <= 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'B': /* Benchmark each trace over this many runs */
+            bench_runs = atoi(optarg);
+            if (bench_runs <= 0 || bench_runs > BENCH_MAX_RUNS) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'J': /* Write the benchmark results to this file */
+            bench_out = strdup(optarg);
+            break;
+        case 'b': /* Compare the benchmark results with this file */
+            bench_base = strdup(optarg);
+            break;
+        case 'C': /* Count hardware events during the replays */
+            run_hw = 1;
+            break;
+        case 'H': /* Histogram the latency of every request */
+            run_lat = 1;
+            break;
+        case 'p': /* Replay each trace on 1, 2, 4, ... threads at once */
+            run_mt = 1;
+            if (!strcmp(optarg, "copy"))
+                mt_mode = MT_COPY;
+            else if (!strcmp(optarg, "split"))
+                mt_mode = MT_SPLIT;
+            else if (!strcmp(optarg, "remote"))
+                mt_mode = MT_REMOTE;
+            else {
+                usage();
+                exit(1);
+            }
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -237,8 +525,30 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* The benchmark would write a timeline for each of its runs */
+    if (bench_runs > 0 && frag_file != NULL) {
+	usage();
+	exit(1);
+    }
+
+    /* 
+     * The threads of -p need the other cores, and the fragmentation
+     * timeline has to come out in order
+     */
+    if (njobs > 1 && (run_mt || frag_file != NULL)) {
+	printf("Evaluating one trace at a time for %s\n", 
+	       run_mt ? "-p" : "-F");
+	njobs = 1;
+    }
+
     /* Initialize the timing package */
     init_fsecs();
+    if (run_lat)
+	lat_calibrate();
+    if (run_hw && pc_open() == 0) {
+	printf("No hardware counters (%s), ignoring -C\n", strerror(errno));
+	run_hw = 0;
+    }
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -253,20 +563,10 @@ int main(int argc, char **argv)
 	    unix_error("libc_stats calloc in main failed");
 	
 	/* Evaluate the libc malloc package using the K-best scheme */
-	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
-	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
-	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
-		if (verbose > 1)
-		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
-	    }
-	    free_trace(trace);
-	}
+	memset(&job, 0, sizeof(job));
+	job.tracefiles = tracefiles;
+	job.stats = libc_stats;
+	run_traces(eval_libc_trace, &job, num_tracefiles, njobs);
 
 	/* Display the libc results in a compact table */
 	if (verbose) {
@@ -275,6 +575,17 @@ int main(int argc, char **argv)
 	}
     }
 
+    /*
+     * The benchmark replaces the usual evaluation of the mm package,
+     * and its exit status says whether it found regressions
+     */
+    if (bench_runs > 0) {
+	mem_init();
+	i = eval_bench(tracefiles, num_tracefiles, bench_runs, 
+		       bench_out, bench_base);
+	exit(i > 0);
+    }
+
     /*
      * Always run and evaluate the student's mm package
      */
@@ -285,35 +596,73 @@ int main(int argc, char **argv)
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
+    mm_counters = (mm_stats_t *)calloc(num_tracefiles, sizeof(mm_stats_t));
+    if (mm_counters == NULL)
+	unix_error("mm_counters calloc in main failed");
+    if (run_lat) {
+	mm_lat = (lathist_t *)calloc(num_tracefiles * NUM_REQTYPES, 
+				     sizeof(lathist_t));
+	if (mm_lat == NULL)
+	    unix_error("mm_lat calloc in main failed");
+    }
+    if (run_mt) {
+	mt_stats = (mtstats_t *)calloc(num_tracefiles * MT_NUMCOUNTS, 
+				       sizeof(mtstats_t));
+	if (mt_stats == NULL)
+	    unix_error("mt_stats calloc in main failed");
+    }
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+    job.tracefiles = tracefiles;
+    job.stats = mm_stats;
+    job.counters = mm_counters;
+    job.lat = mm_lat;
+    job.mt = mt_stats;
+    job.mt_mode = mt_mode;
+    run_traces(eval_mm_trace, &job, num_tracefiles, njobs);
 
     /* Display the mm results in a compact table */
     if (verbose) {
-	printf("\nResults for mm malloc:\n");
+	printf("\nResults for mm malloc (%d-bit build):\n", 
+	       (int)(8 * sizeof(void *)));
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
+	printmmstats(num_tracefiles, mm_stats, mm_counters);
+	printf("\n");
+    }
+
+    /* The policy matrix is the point of -P, so always show it */
+    if (run_policies) {
+	eval_policies(tracefiles, num_tracefiles);
+	printf("\n");
+    }
+
+    /* The touched throughput is the point of -T, so always show it */
+    if (touch_frac > 0) {
+	printtouchresults(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* The hardware events are the point of -C, so always show them */
+    if (run_hw) {
+	printhwresults(num_tracefiles, mm_stats);
+	printf("\n");
+	pc_close();
+    }
+
+    /* The latency results are the point of -H, so always show them */
+    if (run_lat) {
+	printlatresults(num_tracefiles, mm_lat);
+	printf("\n");
+    }
+
+    /* The scalability results are the point of -p, so always show them */
+    if (run_mt) {
+	printmtresults(num_tracefiles, mt_mode, mt_stats);
+	printf("\n");
     }
 
     /* 
@@ -364,21 +713,23 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    frag_close();
+
     exit(0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
@@ -397,36 +748,39 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* 
+     * The payload must lie within the extent of the heap, or within
+     * one of the regions the package has mapped for itself
+     */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_is_mapped(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. The payloads
+     * in the tree are disjoint, so only the last one starting at or
+     * below hi can reach into [lo, hi].
+     */
+    if ((p = find_range(*ranges, hi)) != NULL && p->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = new_range();
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    *ranges = insert_range(*ranges, p);
     return 1;
 }
 
@@ -434,34 +788,152 @@ static int add_range(range_t **ranges, char *lo, int size,
  * remove_range - Free the range record of block whose payload starts at lo 
  */
 static void remove_range(range_t **ranges, char *lo)
+{
+    *ranges = delete_range(*ranges, lo);
+}
+
+/*
+ * clear_ranges - free all of the range records for a trace 
+ */
+static void clear_ranges(range_t **ranges)
+{
+    range_chunk_t *c;
+    range_chunk_t *cnext;
+
+    for (c = range_chunks;  c != NULL;  c = cnext) {
+        cnext = c->next;
+        free(c);
+    }
+    range_chunks = NULL;
+    range_chunk_used = RANGE_CHUNK;
+    free_ranges = NULL;
+    *ranges = NULL;
+}
+
+/*
+ * find_range - Return the range with the highest lo that is at most
+ *     addr, or NULL if there is none
+ */
+static range_t *find_range(range_t *ranges, char *addr)
+{
+    range_t *best = NULL;
+
+    while (ranges != NULL) {
+	if (ranges->lo <= addr) {
+	    best = ranges;
+	    ranges = ranges->right;
+	}
+	else
+	    ranges = ranges->left;
+    }
+    return best;
+}
+
+/*
+ * insert_range - Add range p to the treap rooted at t, rotating it up
+ *     for as long as its priority beats its parent's. Returns the new root.
+ */
+static range_t *insert_range(range_t *t, range_t *p)
+{
+    range_t *c;
+
+    if (t == NULL)
+	return p;
+    if (p->lo < t->lo) {
+	t->left = insert_range(t->left, p);
+	if (t->left->prio > t->prio) {
+	    c = t->left;
+	    t->left = c->right;
+	    c->right = t;
+	    t = c;
+	}
+    }
+    else {
+	t->right = insert_range(t->right, p);
+	if (t->right->prio > t->prio) {
+	    c = t->right;
+	    t->right = c->left;
+	    c->left = t;
+	    t = c;
+	}
+    }
+    return t;
+}
+
+/*
+ * delete_range - Take the range starting at lo, if any, out of the
+ *     treap rooted at t and free it. Returns the new root.
+ */
+static range_t *delete_range(range_t *t, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            // int size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    if (t == NULL)
+	return NULL;
+    if (lo < t->lo)
+	t->left = delete_range(t->left, lo);
+    else if (lo > t->lo)
+	t->right = delete_range(t->right, lo);
+    else {
+	p = t;
+	t = join_ranges(t->left, t->right);
+	put_range(p);
     }
+    return t;
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * join_ranges - Merge treaps l and r, every range of l lying below
+ *     every range of r, into one. Returns its root.
  */
-static void clear_ranges(range_t **ranges)
+static range_t *join_ranges(range_t *l, range_t *r)
+{
+    if (l == NULL)
+	return r;
+    if (r == NULL)
+	return l;
+    if (l->prio > r->prio) {
+	l->right = join_ranges(l->right, r);
+	return l;
+    }
+    r->left = join_ranges(l, r->left);
+    return r;
+}
+
+/*
+ * new_range - Return a fresh range record with a random priority,
+ *     taken from the free records or else from the pool
+ */
+static range_t *new_range(void)
 {
+    range_chunk_t *c;
     range_t *p;
-    range_t *pnext;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    if ((p = free_ranges) != NULL)
+	free_ranges = p->left;
+    else {
+	if (range_chunk_used == RANGE_CHUNK) {
+	    if ((c = (range_chunk_t *)malloc(sizeof(range_chunk_t))) == NULL)
+		unix_error("malloc error in new_range");
+	    c->next = range_chunks;
+	    range_chunks = c;
+	    range_chunk_used = 0;
+	}
+	p = &range_chunks->ranges[range_chunk_used++];
     }
-    *ranges = NULL;
+    p->prio = (unsigned int)rand();
+    p->left = NULL;
+    p->right = NULL;
+    return p;
+}
+
+/*
+ * put_range - Give range record p back for reuse
+ */
+static void put_range(range_t *p)
+{
+    p->left = free_ranges;
+    free_ranges = p;
 }
 
 
@@ -478,7 +950,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    int index, size;
+    int index, size, arg;
     int max_index = 0;
     int op_index;
 
@@ -489,9 +961,17 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
 	
-    /* Read the trace file header */
+    trace->filename = filename;
+
+    /* Binary traces are mapped and decoded in one pass */
     strcpy(path, tracedir);
     strcat(path, filename);
+    if (read_bintrace(path, trace)) {
+	trace->num_reqs = count_reqs(trace);
+	return trace;
+    }
+
+    /* Read the trace file header */
     if ((tracefile = fopen(path, "r")) == NULL) {
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
@@ -509,20 +989,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
       unix_error("fscan of weight");
     }
     
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
+    alloc_trace(trace);
     
     /* read every request line in the trace file */
     index = 0;
@@ -554,6 +1021,31 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
 	    break;
+	case 'm':
+	case 'c':
+	  if ( 3 != fscanf(tracefile, "%u %u %u", &index, &arg, &size) ) {
+	    unix_error("fscanf of memalign or calloc");
+	  } 
+	    set_arg_op(&trace->ops[op_index], type[0] == 'm' ? MEMALIGN : CALLOC,
+		       arg, size, path);
+	    trace->ops[op_index].index = index;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'A':
+	  if ( 3 != fscanf(tracefile, "%u %u %u", &index, &arg, &size) ) {
+	    unix_error("fscanf of batch allocation");
+	  } 
+	    set_arg_op(&trace->ops[op_index], ALLOC_BATCH, arg, size, path);
+	    trace->ops[op_index].index = index;
+	    max_index = (index + arg - 1 > max_index) ? index + arg - 1 : max_index;
+	    break;
+	case 'F':
+	  if ( 2 != fscanf(tracefile, "%u %u", &index, &arg) ) {
+	    unix_error("fscanf of batch free");
+	  } 
+	    set_arg_op(&trace->ops[op_index], FREE_BATCH, arg, 0, path);
+	    trace->ops[op_index].index = index;
+	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
@@ -565,10 +1057,190 @@ static trace_t *read_trace(char *tracedir, char *filename)
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+    trace->num_reqs = count_reqs(trace);
     
     return trace;
 }
 
+/*
+ * count_reqs - Return the number of blocks the requests of trace
+ *    allocate, free or resize, counting a batch once per block
+ */
+static int count_reqs(trace_t *trace)
+{
+    int i, n = 0;
+
+    for (i = 0; i < trace->num_ops; i++) {
+	if (trace->ops[i].type == ALLOC_BATCH || 
+	    trace->ops[i].type == FREE_BATCH)
+	    n += trace->ops[i].arg;
+	else
+	    n++;
+    }
+    return n;
+}
+
+/*
+ * set_arg_op - Fill in a memalign request for size bytes aligned to
+ *    arg, a calloc request for arg elements of size bytes, or a batch
+ *    request for arg blocks (of size bytes), read from tracefile path.
+ *    Exits if arg is no valid alignment or count.
+ */
+static void set_arg_op(traceop_t *op, RequestType type, unsigned int arg,
+		       unsigned int size, char *path)
+{
+    op->type = type;
+    op->arg = arg;
+    op->size = size;
+    if (type == MEMALIGN) {
+	if (arg == 0 || (arg & (arg - 1)) != 0) {
+	    printf("Alignment %u is no power of two in tracefile %s\n", 
+		   arg, path);
+	    exit(1);
+	}
+    }
+    else if (type == ALLOC_BATCH || type == FREE_BATCH) {
+	if (arg == 0 || arg > INT_MAX) {
+	    printf("Bad batch of %u blocks in tracefile %s\n", arg, path);
+	    exit(1);
+	}
+    }
+    else {
+	if (arg == 0 || size > INT_MAX / arg) {
+	    printf("Bad calloc of %u x %u bytes in tracefile %s\n", 
+		   arg, size, path);
+	    exit(1);
+	}
+	op->size = arg * size;
+    }
+}
+
+/*
+ * alloc_trace - Allocate the arrays of a trace whose header has been read
+ */
+static void alloc_trace(trace_t *trace)
+{
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in read_trace");
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+}
+
+/*
+ * read_bintrace - If the file at path is a binary trace (see
+ *     bintrace.h), map it, decode it into trace and return 1. Otherwise
+ *     leave trace alone and return 0.
+ */
+static int read_bintrace(char *path, trace_t *trace)
+{
+    int fd;
+    struct stat st;
+    unsigned char *map;
+    const unsigned char *p, *end;
+    bt_header_t *hdr;
+    unsigned int index, size, arg;
+    RequestType type;
+    int i;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+    if (fstat(fd, &st) < 0)
+	unix_error("fstat failed in read_bintrace");
+    if (st.st_size < (off_t)sizeof(bt_header_t)) {
+	close(fd);
+	return 0;
+    }
+    map = (unsigned char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+	unix_error("mmap failed in read_bintrace");
+    if (!bt_is_binary(map, st.st_size)) {
+	munmap(map, st.st_size);
+	return 0;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    hdr = (bt_header_t *)map;
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    alloc_trace(trace);
+
+    /* Decode every packed request */
+    p = map + sizeof(bt_header_t);
+    end = map + st.st_size;
+    for (i = 0; i < trace->num_ops; i++) {
+	if (p >= end)
+	    break;
+	switch (*p++) {
+	case BT_ALLOC:
+	    trace->ops[i].type = ALLOC;
+	    break;
+	case BT_REALLOC:
+	    trace->ops[i].type = REALLOC;
+	    break;
+	case BT_FREE:
+	    trace->ops[i].type = FREE;
+	    break;
+	case BT_MEMALIGN:
+	    trace->ops[i].type = MEMALIGN;
+	    break;
+	case BT_CALLOC:
+	    trace->ops[i].type = CALLOC;
+	    break;
+	case BT_ALLOC_BATCH:
+	    trace->ops[i].type = ALLOC_BATCH;
+	    break;
+	case BT_FREE_BATCH:
+	    trace->ops[i].type = FREE_BATCH;
+	    break;
+	default:
+	    printf("Bogus type character (%c) in tracefile %s\n", 
+		   p[-1], path);
+	    exit(1);
+	}
+	type = trace->ops[i].type;
+	size = arg = 0;
+	if ((p = bt_get_varint(p, end, &index)) == NULL ||
+	    (type != ALLOC && type != FREE && type != REALLOC &&
+	     (p = bt_get_varint(p, end, &arg)) == NULL) ||
+	    (type != FREE && type != FREE_BATCH && 
+	     (p = bt_get_varint(p, end, &size)) == NULL))
+	    break;
+	if (index >= (unsigned int)trace->num_ids ||
+	    ((type == ALLOC_BATCH || type == FREE_BATCH) &&
+	     arg > (unsigned int)trace->num_ids - index)) {
+	    printf("Block index %u out of range in tracefile %s\n", 
+		   index, path);
+	    exit(1);
+	}
+	trace->ops[i].index = index;
+	trace->ops[i].size = size;
+	if (type != ALLOC && type != FREE && type != REALLOC)
+	    set_arg_op(&trace->ops[i], type, arg, size, path);
+    }
+    if (i != trace->num_ops || p != end) {
+	printf("Truncated or oversized tracefile %s\n", path);
+	exit(1);
+    }
+
+    munmap(map, st.st_size);
+    return 1;
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
  *              to, all of which were allocated in read_trace().
@@ -598,8 +1270,9 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *newp;
     char *oldp;
     char *p;
+    char msg[MAXLINE];
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -617,20 +1290,41 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case MEMALIGN: /* mm_memalign */
+        case CALLOC: /* mm_calloc */
 
 	    /* Call the student's malloc */
-	  if ((p = (char*) mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	  if ((p = (char*) mm_alloc_op(&trace->ops[i])) == NULL) {
+		sprintf(msg, "mm_%s failed.", req_names[trace->ops[i].type]);
+		malloc_error(tracenum, i, msg);
 		return 0;
 	    }
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range tree if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
 		return 0;
+
+	    /* Aligned and zeroed blocks must be so */
+	    if (trace->ops[i].type == MEMALIGN && 
+		(uintptr_t)p % trace->ops[i].arg != 0) {
+		sprintf(msg, "mm_memalign payload (%p) not aligned to %d bytes",
+			p, trace->ops[i].arg);
+		malloc_error(tracenum, i, msg);
+		return 0;
+	    }
+	    if (trace->ops[i].type == CALLOC) {
+		for (j = 0; j < size; j++) {
+		    if (p[j] != 0) {
+			malloc_error(tracenum, i, "mm_calloc did not zero the "
+				     "block");
+			return 0;
+		    }
+		}
+	    }
 	    
 	    /* ADDED: cgw
 	     * fill range with low byte of index.  This will be used later
@@ -646,17 +1340,24 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         case REALLOC: /* mm_realloc */
 	    
-	    /* Call the student's realloc */
+	    /* Call the student's realloc, first with sizes too big to
+	     * satisfy, which must fail and leave the old block alone */
 	    oldp = trace->blocks[index];
+	    if (mm_realloc(oldp, SIZE_MAX) != NULL ||
+		mm_realloc(oldp, SIZE_MAX - 8) != NULL) {
+		malloc_error(tracenum, i, "mm_realloc of nearly SIZE_MAX "
+			     "bytes did not fail");
+		return 0;
+	    }
 	    if ((newp = (char *) mm_realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range tree */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to range tree */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
@@ -668,7 +1369,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -683,14 +1384,36 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         case FREE: /* mm_free */
 	    
-	    /* Remove region from list and call student's free function */
+	    /* Remove region from tree and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
 	    mm_free(p);
 	    break;
 
-	default:
-	    app_error("Nonexistent request type in eval_mm_valid");
+        case ALLOC_BATCH: /* mm_malloc_batch */
+	    if (!mm_batch_op(&trace->ops[i], trace->blocks)) {
+		malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		return 0;
+	    }
+
+	    /* Check and fill in every block as for mm_malloc */
+	    for (j = 0; j < trace->ops[i].arg; j++) {
+		p = trace->blocks[index + j];
+		if (add_range(ranges, p, size, tracenum, i) == 0)
+		    return 0;
+		memset(p, (index + j) & 0xFF, size);
+		trace->block_sizes[index + j] = size;
+	    }
+	    break;
+
+        case FREE_BATCH: /* mm_free_batch */
+	    for (j = 0; j < trace->ops[i].arg; j++)
+		remove_range(ranges, trace->blocks[index + j]);
+	    mm_batch_op(&trace->ops[i], trace->blocks);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
     }
@@ -704,15 +1427,19 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
- *   
+ *   largest size the heap reached while running the student's malloc 
+ *   package on the trace. The package may shrink the heap again with
+ *   a negative mem_sbrk, so that peak is kept alongside the final size
+ *   in *stats. Regions that the package maps with mem_map count as
+ *   heap for as long as they are mapped. The allocator's statistics
+ *   at the end of the trace go to *counters.
+ *   With -F, the state of the heap is also sampled every frag_interval
+ *   requests.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static void eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			 stats_t *stats, mm_stats_t *counters)
 {   
-    int i;
+    int i, j;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
@@ -729,10 +1456,12 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case MEMALIGN: /* mm_memalign */
+        case CALLOC: /* mm_calloc */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = (char *) mm_malloc(size)) == NULL) 
+	    if ((p = (char *) mm_alloc_op(&trace->ops[i])) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -783,13 +1512,40 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if (!mm_batch_op(&trace->ops[i], trace->blocks))
+		app_error("mm_malloc_batch failed in eval_mm_util");
+	    for (j = 0; j < trace->ops[i].arg; j++)
+		trace->block_sizes[index + j] = size;
+	    total_size += trace->ops[i].arg * size;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+        case FREE_BATCH: /* mm_free_batch */
+	    index = trace->ops[i].index;
+	    for (j = 0; j < trace->ops[i].arg; j++)
+		total_size -= trace->block_sizes[index + j];
+	    mm_batch_op(&trace->ops[i], trace->blocks);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+	if (frag_file != NULL && (i + 1) % frag_interval == 0)
+	    frag_sample(trace, tracenum, i + 1, total_size);
     }
+    if (frag_file != NULL && trace->num_ops % frag_interval != 0)
+	frag_sample(trace, tracenum, trace->num_ops, total_size);
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    mm_stats(counters);
+    stats->peak_heap = mem_peak_footprint();
+    stats->final_heap = mem_heapsize() + mem_mapsize();
+    stats->util = (double)max_total_size / (double)stats->peak_heap;
 }
 
 
@@ -799,9 +1555,14 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int i, index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    lathist_t *lat = ((speed_t *)ptr)->lat;
+    int touch = ((speed_t *)ptr)->touch;
+    unsigned long long start = 0;
+    traceop_t *op;
+    int j;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
@@ -809,15 +1570,23 @@ static void eval_mm_speed(void *ptr)
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
+    for (i = 0;  i < trace->num_ops;  i++) {
+	if (lat != NULL)
+	    start = read_counter();
+
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case MEMALIGN: /* mm_memalign */
+        case CALLOC: /* mm_calloc */
             index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = (char *) mm_malloc(size)) == NULL)
+            if ((p = (char *) mm_alloc_op(&trace->ops[i])) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+	    if (touch) {
+		trace->block_sizes[index] = trace->ops[i].size;
+		touch_write(p, trace->ops[i].size);
+	    }
             break;
 
 	case REALLOC: /* mm_realloc */
@@ -827,17 +1596,153 @@ static void eval_mm_speed(void *ptr)
             if ((newp = (char *) mm_realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
+	    if (touch) {
+		trace->block_sizes[index] = newsize;
+		touch_write(newp, newsize);
+	    }
             break;
 
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
+	    if (touch)
+		touch_read(block, trace->block_sizes[index]);
             mm_free(block);
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+        case FREE_BATCH: /* mm_free_batch */
+	    op = &trace->ops[i];
+	    if (touch && op->type == FREE_BATCH)
+		for (j = 0; j < op->arg; j++)
+		    touch_read(trace->blocks[op->index + j], 
+			       trace->block_sizes[op->index + j]);
+	    if (!mm_batch_op(op, trace->blocks))
+		app_error("mm_malloc_batch error in eval_mm_speed");
+	    if (touch && op->type == ALLOC_BATCH)
+		for (j = 0; j < op->arg; j++) {
+		    trace->block_sizes[op->index + j] = op->size;
+		    touch_write(trace->blocks[op->index + j], op->size);
+		}
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+
+	if (lat != NULL)
+	    lat_record(&lat[trace->ops[i].type], read_counter() - start);
+    }
+}
+
+/*
+ * touch_len - The number of bytes -T touches of a size-byte payload,
+ *    at least one
+ */
+static size_t touch_len(size_t size)
+{
+    size_t n = (size_t)(size * touch_frac);
+
+    return n == 0 && size > 0 ? 1 : n;
+}
+
+/*
+ * touch_write - Write a byte of each cache line in the first touch_frac
+ *    of the size bytes of payload p, as a program filling in a new
+ *    block would, so that blocks spread over many lines and pages cost
+ *    the replay cache and TLB misses
+ */
+static void touch_write(char *p, size_t size)
+{
+    size_t n = touch_len(size), k;
+
+    for (k = 0; k < n; k += TOUCH_STRIDE)
+	p[k] = (char)k;
+}
+
+/*
+ * touch_read - Read back what touch_write wrote, before p is freed
+ */
+static void touch_read(char *p, size_t size)
+{
+    size_t n = touch_len(size), k;
+    unsigned char x = 0;
+
+    for (k = 0; k < n; k += TOUCH_STRIDE)
+	x += p[k];
+    touch_sink += x;
+}
+
+/*
+ * mm_alloc_op - Call the mm package's allocator that request op, an
+ *    ALLOC, MEMALIGN or CALLOC, asks for, and return its block
+ */
+static void *mm_alloc_op(traceop_t *op)
+{
+    switch (op->type) {
+    case MEMALIGN:
+	return mm_memalign(op->arg, op->size);
+    case CALLOC:
+	return mm_calloc(op->arg, op->size / op->arg);
+    default:
+	return mm_malloc(op->size);
+    }
+}
+
+/*
+ * libc_alloc_op - mm_alloc_op for the libc malloc package
+ */
+static void *libc_alloc_op(traceop_t *op)
+{
+    void *p;
+
+    switch (op->type) {
+    case MEMALIGN:
+	if (posix_memalign(&p, op->arg < sizeof(void *) ? sizeof(void *) : 
+			   op->arg, op->size) != 0)
+	    return NULL;
+	return p;
+    case CALLOC:
+	return calloc(op->arg, op->size / op->arg);
+    default:
+	return malloc(op->size);
+    }
+}
+
+/*
+ * mm_batch_op - Carry out batch request op, an ALLOC_BATCH or
+ *    FREE_BATCH, on the blocks from blocks[op->index] on with the mm
+ *    package. Returns 0 if mm_malloc_batch came up short. 
+ *
+ *    mm_free_batch sorts the blocks it frees in place, which is
+ *    harmless here: none of them is looked up again before a later
+ *    request allocates it anew.
+ */
+static int mm_batch_op(traceop_t *op, char **blocks)
+{
+    if (op->type == FREE_BATCH) {
+	mm_free_batch((void **)&blocks[op->index], op->arg);
+	return 1;
+    }
+    return mm_malloc_batch(op->size, op->arg, (void **)&blocks[op->index])
+	== (size_t)op->arg;
+}
+
+/*
+ * libc_batch_op - mm_batch_op for the libc malloc package, which has
+ *    no batch interface: one malloc or free per block
+ */
+static int libc_batch_op(traceop_t *op, char **blocks)
+{
+    int j;
+
+    for (j = op->index; j < op->index + op->arg; j++) {
+	if (op->type == FREE_BATCH)
+	    free(blocks[j]);
+	else if ((blocks[j] = (char *) malloc(op->size)) == NULL)
+	    return 0;
+    }
+    return 1;
 }
 
 /*
@@ -855,7 +1760,9 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* malloc */
-	  if ((p = (char *) malloc(trace->ops[i].size)) == NULL) {
+        case MEMALIGN: /* posix_memalign */
+        case CALLOC: /* calloc */
+	  if ((p = (char *) libc_alloc_op(&trace->ops[i])) == NULL) {
 		malloc_error(tracenum, i, "libc malloc failed");
 		unix_error("System message");
 	    }
@@ -876,6 +1783,14 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+        case ALLOC_BATCH: /* malloc per block */
+        case FREE_BATCH: /* free per block */
+	    if (!libc_batch_op(&trace->ops[i], trace->blocks)) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -892,16 +1807,17 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 static void eval_libc_speed(void *ptr)
 {
     int i;
-    int index, size, newsize;
+    int index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
         case ALLOC: /* malloc */
+        case MEMALIGN: /* posix_memalign */
+        case CALLOC: /* calloc */
 	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = (char *) malloc(size)) == NULL)
+	    if ((p = (char *) libc_alloc_op(&trace->ops[i])) == NULL)
 		unix_error("malloc failed in eval_libc_speed");
 	    trace->blocks[index] = p;
 	    break;
@@ -921,8 +1837,1203 @@ static void eval_libc_speed(void *ptr)
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
+
+        case ALLOC_BATCH: /* malloc per block */
+        case FREE_BATCH: /* free per block */
+	    if (!libc_batch_op(&trace->ops[i], trace->blocks))
+		unix_error("malloc failed in eval_libc_speed");
+	    break;
+	}
+    }
+}
+
+/*
+ * eval_policies - Check, and measure the utilization and throughput
+ *    of, every trace under every placement policy of the mm package,
+ *    and print the results as a matrix. Under -T the throughput is
+ *    that with the payloads touched.
+ */
+static void eval_policies(char **tracefiles, int num_tracefiles)
+{
+    const char *name;
+    trace_t *trace;
+    range_t *ranges = NULL;
+    speed_t speed_params;
+    mm_stats_t counters;
+    stats_t *stats;
+    stats_t *totals;
+    int npolicies, i, p;
+
+    for (npolicies = 0; mm_policy_name(npolicies) != NULL; npolicies++)
+	;
+    if ((stats = (stats_t *)calloc(num_tracefiles * npolicies, 
+				   sizeof(stats_t))) == NULL ||
+	(totals = (stats_t *)calloc(npolicies, sizeof(stats_t))) == NULL)
+	unix_error("stats calloc in eval_policies failed");
+
+    /* Read each trace once and run it under every policy */
+    for (i = 0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	for (p = 0; p < npolicies; p++) {
+	    stats_t *st = &stats[i * npolicies + p];
+
+	    mm_set_policy(mm_policy_name(p));
+	    if (verbose > 1)
+		printf("Checking %s fit on %s\n", mm_policy_name(p), 
+		       tracefiles[i]);
+	    st->ops = trace->num_reqs;
+	    st->valid = eval_mm_valid(trace, i, &ranges);
+	    if (st->valid) {
+		eval_mm_util(trace, i, &ranges, st, &counters);
+		speed_params.trace = trace;
+		speed_params.ranges = ranges;
+		speed_params.lat = NULL;
+		/* Under -T, locality is what tells the policies apart */
+		speed_params.touch = touch_frac > 0;
+		st->secs = fsecs(eval_mm_speed, &speed_params);
+	    }
+	}
+	free_trace(trace);
+    }
+    clear_ranges(&ranges);
+
+    /* One column of util and Kops per policy */
+    if (touch_frac > 0)
+	printf("Results for mm malloc under each placement policy (util%% Kops,\n"
+	       "touching %.0f%% of each payload):\n", touch_frac*100.0);
+    else
+	printf("Results for mm malloc under each placement policy (util%% Kops):\n");
+    printf("%5s", "trace");
+    for (p = 0; p < npolicies; p++) {
+	name = mm_policy_name(p);
+	printf("%15s", name);
+    }
+    printf("\n");
+    for (i = 0; i < num_tracefiles; i++) {
+	printf("%2d   ", i);
+	for (p = 0; p < npolicies; p++) {
+	    stats_t *st = &stats[i * npolicies + p];
+	    if (!st->valid) {
+		printf("%15s", "-");
+		continue;
+	    }
+	    printf("%7.0f%%%7.0f", st->util*100.0, (st->ops/1e3)/st->secs);
+	    totals[p].util += st->util;
+	    totals[p].ops += st->ops;
+	    totals[p].secs += st->secs;
+	}
+	printf("\n");
+    }
+    printf("%-5s", "Total");
+    for (p = 0; p < npolicies; p++)
+	printf("%7.0f%%%7.0f", (totals[p].util/num_tracefiles)*100.0, 
+	       (totals[p].ops/1e3)/totals[p].secs);
+    printf("\n");
+    free(totals);
+    free(stats);
+}
+
+/**********************************************************************
+ * The following functions make up the benchmark mode (-B): repeated
+ * measurements of each trace, summarized by their median and its
+ * confidence interval, and compared against a baseline.
+ **********************************************************************/
+
+/*
+ * eval_bench - Check every trace, then replay each BENCH_WARMUP times
+ *    untimed and measure its util and throughput runs times. The runs
+ *    go round the traces, so that each trace is sampled over the whole
+ *    benchmark and a passing disturbance doesn't hit just one. Prints
+ *    the medians and their confidence intervals, writes them and the
+ *    samples to JSON file json unless it is NULL, and compares them
+ *    against the baseline file base, if not NULL, written by an earlier
+ *    -B -J run. Returns the number of regressions and invalid traces.
+ */
+static int eval_bench(char **tracefiles, int num_tracefiles, int runs,
+		      char *json, char *base)
+{
+    trace_t **traces;
+    range_t *ranges = NULL;
+    speed_t speed_params;
+    stats_t st;
+    mm_stats_t counters;
+    double *kops, *util, *perf, *tsecs, *tops, *tutil;
+    int *valid;
+    int i, r, nvalid = 0, bad = 0;
+
+    /* Samples of trace i are at [i*runs], the totals at [num_tracefiles*runs] */
+    if ((kops = calloc((num_tracefiles + 1) * runs, sizeof(double))) == NULL ||
+	(util = calloc((num_tracefiles + 1) * runs, sizeof(double))) == NULL ||
+	(perf = calloc(runs, sizeof(double))) == NULL ||
+	(tsecs = calloc(runs, sizeof(double))) == NULL ||
+	(tops = calloc(runs, sizeof(double))) == NULL ||
+	(tutil = calloc(runs, sizeof(double))) == NULL ||
+	(valid = calloc(num_tracefiles, sizeof(int))) == NULL ||
+	(traces = calloc(num_tracefiles, sizeof(trace_t *))) == NULL)
+	unix_error("calloc in eval_bench failed");
+
+    for (i = 0; i < num_tracefiles; i++) {
+	traces[i] = read_trace(tracedir, tracefiles[i]);
+	if (verbose > 1)
+	    printf("Checking %s\n", tracefiles[i]);
+	if ((valid[i] = eval_mm_valid(traces[i], i, &ranges)))
+	    nvalid++;
+	else
+	    bad++;
+    }
+
+    speed_params.lat = NULL;
+    speed_params.touch = 0;
+    for (r = -BENCH_WARMUP; r < runs; r++) {
+	if (verbose > 1)
+	    printf("%s run %d\n", r < 0 ? "Warmup" : "Timed", 
+		   r < 0 ? r + BENCH_WARMUP + 1 : r + 1);
+	for (i = 0; i < num_tracefiles; i++) {
+	    if (!valid[i])
+		continue;
+	    eval_mm_util(traces[i], i, &ranges, &st, &counters);
+	    speed_params.trace = traces[i];
+	    speed_params.ranges = ranges;
+	    if (r < 0) {
+		eval_mm_speed(&speed_params);
+		continue;
+	    }
+	    st.secs = fsecs(eval_mm_speed, &speed_params);
+	    kops[i*runs + r] = (traces[i]->num_reqs/1e3) / st.secs;
+	    util[i*runs + r] = st.util;
+	    tsecs[r] += st.secs;
+	    tops[r] += traces[i]->num_reqs;
+	    tutil[r] += st.util;
+	}
+    }
+    clear_ranges(&ranges);
+    for (i = 0; i < num_tracefiles; i++)
+	free_trace(traces[i]);
+    free(traces);
+
+    /* The totals and perf index of each run, as main computes them */
+    for (r = 0; r < runs && nvalid > 0; r++) {
+	kops[num_tracefiles*runs + r] = (tops[r]/1e3) / tsecs[r];
+	util[num_tracefiles*runs + r] = tutil[r] / nvalid;
+	perf[r] = 100.0 * (UTIL_WEIGHT * tutil[r] / nvalid + 
+			   (1.0 - UTIL_WEIGHT) * 
+			   (tops[r]/tsecs[r] > AVG_LIBC_THRUPUT ? 1.0 :
+			    tops[r]/tsecs[r] / AVG_LIBC_THRUPUT));
+    }
+
+    bad += bench_report(tracefiles, num_tracefiles, runs, valid, 
+			kops, util, perf, base);
+    if (json != NULL)
+	bench_json(json, tracefiles, num_tracefiles, runs, valid, 
+		   kops, util, perf);
+
+    free(kops);
+    free(util);
+    free(perf);
+    free(tsecs);
+    free(tops);
+    free(tutil);
+    free(valid);
+    return bad;
+}
+
+/*
+ * bench_report - Print the benchmark results and, given a baseline
+ *    file base, how they compare to it. Returns the number of
+ *    regressions: traces (or the total) whose Kops or util is
+ *    significantly lower than the baseline's, by more than
+ *    BENCH_MIN_KOPS or BENCH_MIN_UTIL.
+ */
+static int bench_report(char **tracefiles, int num_tracefiles, int runs,
+			int *valid, double *kops, double *util, double *perf,
+			char *base)
+{
+    char *basetext = NULL, *from;
+    double *bkops = NULL, *butil = NULL;
+    double k[3], u[3], bk[3], bu[3], zk, zu;
+    int i, nk, nu, matched = 0, missing = 0, regressions = 0;
+    const char *verdict;
+
+    if (base != NULL) {
+	if ((basetext = read_file(base)) == NULL)
+	    unix_error(base);
+	if ((bkops = malloc(BENCH_MAX_RUNS * sizeof(double))) == NULL ||
+	    (butil = malloc(BENCH_MAX_RUNS * sizeof(double))) == NULL)
+	    unix_error("malloc in bench_report failed");
+    }
+
+    printf("Benchmark of mm malloc (%d-bit build), median [%.0f%% CI] of %d runs:\n",
+	   (int)(8 * sizeof(void *)), 100.0 * (1 - 2*normal_tail(BENCH_Z)), runs);
+    printf("%5s%27s%24s", "trace", "Kops", "util");
+    if (base != NULL)
+	printf("%10s%8s%10s%7s  %s", "base Kops", "change", "base util", 
+	       "change", "verdict");
+    printf("\n");
+
+    for (i = 0; i <= num_tracefiles; i++) {
+	if (i < num_tracefiles && !valid[i]) {
+	    printf("%2d%29s\n", i, "invalid");
+	    missing = 1;
+	    continue;
+	}
+	median_ci(&kops[i*runs], runs, k);
+	median_ci(&util[i*runs], runs, u);
+	if (i < num_tracefiles)
+	    printf("%2d   ", i);
+	else
+	    printf("%-5s", "Total");
+	printf("%8.0f [%7.0f, %7.0f]%6.1f%% [%5.1f%%, %5.1f%%]", 
+	       k[0], k[1], k[2], u[0]*100, u[1]*100, u[2]*100);
+	if (base == NULL) {
+	    printf("\n");
+	    continue;
+	}
+
+	/* 
+	 * Find the trace in the baseline, or the total if the baseline
+	 * has the same traces
+	 */
+	if (i < num_tracefiles)
+	    from = json_find_name(basetext, tracefiles[i]);
+	else
+	    from = !missing && matched == json_count_names(basetext) ?
+		strstr(basetext, "\"total\"") : NULL;
+	nk = from ? json_samples(from, "kops", bkops, BENCH_MAX_RUNS) : 0;
+	nu = from ? json_samples(from, "util", butil, BENCH_MAX_RUNS) : 0;
+	if (nk == 0 || nu == 0) {
+	    printf("%10s\n", "-");
+	    missing = 1;
+	    continue;
+	}
+	matched++;
+	median_ci(bkops, nk, bk);
+	median_ci(butil, nu, bu);
+	zk = mann_whitney_z(&kops[i*runs], runs, bkops, nk);
+	zu = mann_whitney_z(&util[i*runs], runs, butil, nu);
+	verdict = "";
+	if ((zk < -BENCH_Z && k[0] < bk[0] * (1 - BENCH_MIN_KOPS)) ||
+	    (zu < -BENCH_Z && u[0] < bu[0] - BENCH_MIN_UTIL)) {
+	    verdict = "REGRESSION";
+	    regressions++;
+	}
+	else if ((zk > BENCH_Z && k[0] > bk[0] * (1 + BENCH_MIN_KOPS)) ||
+		 (zu > BENCH_Z && u[0] > bu[0] + BENCH_MIN_UTIL))
+	    verdict = "better";
+	printf("%10.0f%+7.1f%%%9.1f%%%+7.1f  %s\n", 
+	       bk[0], (k[0]/bk[0] - 1) * 100, bu[0]*100, (u[0] - bu[0])*100,
+	       verdict);
+    }
+    median_ci(perf, runs, k);
+    printf("Perf index = %.1f [%.1f, %.1f]/100\n", k[0], k[1], k[2]);
+    if (base != NULL)
+	printf("%d regression%s against %s\n", regressions, 
+	       regressions == 1 ? "" : "s", base);
+
+    free(basetext);
+    free(bkops);
+    free(butil);
+    return regressions;
+}
+
+/*
+ * bench_json - Write the benchmark results to file path as JSON: for
+ *    each valid trace and the total, the median and confidence interval
+ *    of Kops and util and the samples they come from
+ */
+static void bench_json(char *path, char **tracefiles, int num_tracefiles,
+		       int runs, int *valid, double *kops, double *util, 
+		       double *perf)
+{
+    FILE *fp;
+    int i, first = 1;
+
+    if ((fp = fopen(path, "w")) == NULL)
+	unix_error(path);
+    fprintf(fp, "{\n  \"bits\": %d,\n  \"runs\": %d,\n  \"warmup\": %d,\n"
+	    "  \"traces\": [\n", (int)(8 * sizeof(void *)), runs, BENCH_WARMUP);
+    for (i = 0; i < num_tracefiles; i++) {
+	if (!valid[i])
+	    continue;
+	fprintf(fp, "%s    {\"name\": ", first ? "" : ",\n");
+	json_string(fp, tracefiles[i]);
+	fprintf(fp, ",\n");
+	json_series(fp, "kops", &kops[i*runs], runs, ",");
+	json_series(fp, "util", &util[i*runs], runs, "}");
+	first = 0;
+    }
+    fprintf(fp, "\n  ],\n  \"total\": {\n");
+    json_series(fp, "kops", &kops[num_tracefiles*runs], runs, ",");
+    json_series(fp, "util", &util[num_tracefiles*runs], runs, ",");
+    json_series(fp, "perfidx", perf, runs, "}\n}\n");
+    fclose(fp);
+}
+
+/*
+ * json_series - Write "key": {median, CI and samples of x[0..n-1]},
+ *    followed by end
+ */
+static void json_series(FILE *fp, const char *key, double *x, int n,
+			const char *end)
+{
+    double m[3];
+    int r;
+
+    median_ci(x, n, m);
+    fprintf(fp, "     \"%s\": {\"median\": %.6g, \"lo\": %.6g, \"hi\": %.6g, "
+	    "\"samples\": [", key, m[0], m[1], m[2]);
+    for (r = 0; r < n; r++)
+	fprintf(fp, "%s%.6g", r ? ", " : "", x[r]);
+    fprintf(fp, "]}%s\n", end);
+}
+
+/*
+ * json_string - Write s as a JSON string
+ */
+static void json_string(FILE *fp, const char *s)
+{
+    putc('"', fp);
+    for (; *s != '\0'; s++) {
+	if (*s == '"' || *s == '\\')
+	    putc('\\', fp);
+	if ((unsigned char)*s < ' ')
+	    fprintf(fp, "\\u%04x", *s);
+	else
+	    putc(*s, fp);
+    }
+    putc('"', fp);
+}
+
+/*
+ * json_find_name - Return where the object with "name": name starts in
+ *    text, as bench_json writes it, or NULL
+ */
+static char *json_find_name(char *text, const char *name)
+{
+    size_t len = strlen(name);
+    char *p;
+
+    for (p = text; (p = strstr(p, "\"name\"")) != NULL; p++) {
+	char *q = p + strlen("\"name\"");
+
+	while (*q == ' ' || *q == ':')
+	    q++;
+	if (*q == '"' && strncmp(q + 1, name, len) == 0 && q[len + 1] == '"')
+	    return p;
+    }
+    return NULL;
+}
+
+/*
+ * json_count_names - Return the number of traces in text, as
+ *    bench_json writes it
+ */
+static int json_count_names(char *text)
+{
+    int n = 0;
+
+    for (; (text = strstr(text, "\"name\"")) != NULL; text++)
+	n++;
+    return n;
+}
+
+/*
+ * json_samples - Read the samples of the first series key after from
+ *    into out, at most max of them, and return how many there are
+ */
+static int json_samples(char *from, const char *key, double *out, int max)
+{
+    char pat[MAXLINE];
+    char *p, *end;
+    int n = 0;
+
+    snprintf(pat, sizeof(pat), "\"%s\"", key);
+    if ((p = strstr(from, pat)) == NULL || 
+	(p = strstr(p, "\"samples\"")) == NULL ||
+	(p = strchr(p, '[')) == NULL)
+	return 0;
+    for (p++; n < max; p = end) {
+	while (*p == ' ' || *p == ',' || *p == '\n')
+	    p++;
+	out[n] = strtod(p, &end);
+	if (end == p)
+	    break;
+	n++;
+    }
+    return n;
+}
+
+/*
+ * read_file - Return the contents of file path as a string, or NULL
+ */
+static char *read_file(char *path)
+{
+    FILE *fp;
+    char *buf;
+    long len;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	return NULL;
+    if (fseek(fp, 0, SEEK_END) < 0 || (len = ftell(fp)) < 0 ||
+	fseek(fp, 0, SEEK_SET) < 0 || (buf = malloc(len + 1)) == NULL) {
+	fclose(fp);
+	return NULL;
+    }
+    len = fread(buf, 1, len, fp);
+    buf[len] = '\0';
+    fclose(fp);
+    return buf;
+}
+
+static int dbl_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * median_ci - Set m[0] to the median of x[0..n-1] and m[1], m[2] to
+ *    the ends of its distribution-free confidence interval: the order
+ *    statistics whose ranks bound the BENCH_Z quantile of the
+ *    binomial(n, 1/2) count of samples below the median
+ */
+static void median_ci(double *x, int n, double *m)
+{
+    double *s;
+    int lo, hi;
+
+    if ((s = malloc(n * sizeof(double))) == NULL)
+	unix_error("malloc in median_ci failed");
+    memcpy(s, x, n * sizeof(double));
+    qsort(s, n, sizeof(double), dbl_cmp);
+    m[0] = n % 2 ? s[n/2] : (s[n/2 - 1] + s[n/2]) / 2;
+    lo = (int)floor(n/2.0 - BENCH_Z * sqrt(n) / 2);
+    hi = (int)ceil(1 + n/2.0 + BENCH_Z * sqrt(n) / 2);
+    m[1] = s[lo < 1 ? 0 : lo - 1];
+    m[2] = s[hi > n ? n - 1 : hi - 1];
+    free(s);
+}
+
+/*
+ * mann_whitney_z - The Mann-Whitney U statistic of samples x against
+ *    samples y as a normal deviate, corrected for ties: large and
+ *    positive if x tends to be larger, negative if it tends to be
+ *    smaller, near 0 if neither
+ */
+static double mann_whitney_z(double *x, int nx, double *y, int ny)
+{
+    double *all, rank, rsum = 0, ties = 0, u, var;
+    int n = nx + ny, i, j, k;
+
+    if ((all = malloc(n * sizeof(double))) == NULL)
+	unix_error("malloc in mann_whitney_z failed");
+    memcpy(all, x, nx * sizeof(double));
+    memcpy(all + nx, y, ny * sizeof(double));
+    qsort(all, n, sizeof(double), dbl_cmp);
+
+    /* Each x sample gets the average rank of the values equal to it */
+    for (i = 0; i < n; i = j) {
+	for (j = i; j < n && all[j] == all[i]; j++)
+	    ;
+	rank = (i + 1 + j) / 2.0;
+	ties += (double)(j - i) * (j - i) * (j - i) - (j - i);
+	for (k = 0; k < nx; k++)
+	    if (x[k] == all[i])
+		rsum += rank;
+    }
+    free(all);
+
+    u = rsum - nx * (nx + 1) / 2.0;
+    var = nx * (double)ny / 12.0 * ((n + 1) - ties / ((double)n * (n - 1)));
+    if (var <= 0)
+	return 0;
+    return (u - nx * (double)ny / 2.0) / sqrt(var);
+}
+
+/*
+ * normal_tail - The probability that a standard normal variate
+ *    exceeds z
+ */
+static double normal_tail(double z)
+{
+    return erfc(z / sqrt(2.0)) / 2;
+}
+
+/**********************************************************************
+ * The following functions evaluate each trace for main, one after the
+ * other or, under -j, in worker processes of their own.
+ **********************************************************************/
+
+/*
+ * eval_libc_trace - Check, and measure the throughput of, trace
+ *    tracenum with the libc malloc package into job->stats
+ */
+static void eval_libc_trace(evaljob_t *job, int tracenum)
+{
+    stats_t *st = &job->stats[tracenum];
+    speed_t speed_params;
+    trace_t *trace;
+
+    trace = read_trace(tracedir, job->tracefiles[tracenum]);
+    st->ops = trace->num_reqs;
+    if (verbose > 1)
+	printf("Checking libc malloc for correctness, ");
+    st->valid = eval_libc_valid(trace, tracenum);
+    if (st->valid) {
+	speed_params.trace = trace;
+	speed_params.lat = NULL;
+	speed_params.touch = 0;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	st->secs = fsecs(eval_libc_speed, &speed_params);
+    }
+    free_trace(trace);
+}
+
+/*
+ * eval_mm_trace - Check, and measure the utilization and throughput
+ *    of, trace tracenum with the mm package, along with whatever else
+ *    the command line asked for, into job's arrays
+ */
+static void eval_mm_trace(evaljob_t *job, int tracenum)
+{
+    stats_t *st = &job->stats[tracenum];
+    speed_t speed_params;
+    range_t *ranges = NULL;
+    trace_t *trace;
+    int k;
+
+    trace = read_trace(tracedir, job->tracefiles[tracenum]);
+    st->ops = trace->num_reqs;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    st->valid = eval_mm_valid(trace, tracenum, &ranges);
+    if (st->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	eval_mm_util(trace, tracenum, &ranges, st, &job->counters[tracenum]);
+	speed_params.trace = trace;
+	speed_params.ranges = ranges;
+	speed_params.lat = NULL;
+	speed_params.touch = 0;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	st->secs = fsecs(eval_mm_speed, &speed_params);
+	if (touch_frac > 0) {
+	    if (verbose > 1)
+		printf("Timing it again touching the payloads.\n");
+	    speed_params.touch = 1;
+	    st->touch_secs = fsecs(eval_mm_speed, &speed_params);
+	    speed_params.touch = 0;
+	}
+	if (run_hw) {
+	    /* One more, untimed, run under the hardware counters */
+	    if (verbose > 1)
+		printf("Counting hardware events.\n");
+	    pc_start();
+	    eval_mm_speed(&speed_params);
+	    pc_stop(&st->hw);
+	}
+	if (job->lat != NULL) {
+	    /* One more, untimed, run that times every request */
+	    if (verbose > 1)
+		printf("Timing each request.\n");
+	    speed_params.lat = &job->lat[tracenum * NUM_REQTYPES];
+	    eval_mm_speed(&speed_params);
+	    speed_params.lat = NULL;
+	}
+	if (job->mt != NULL) {
+	    if (verbose > 1)
+		printf("Replaying on 1 to %d threads.\n", MT_MAX_THREADS);
+	    for (k = 0; k < MT_NUMCOUNTS; k++)
+		eval_mm_threads(trace, job->mt_mode, mt_threads[k],
+				&job->mt[tracenum * MT_NUMCOUNTS + k]);
+	}
+    }
+    clear_ranges(&ranges);
+    free_trace(trace);
+}
+
+/*
+ * run_traces - Evaluate each of the traces with eval. With njobs > 1,
+ *    up to njobs traces are evaluated at once, each by a worker process
+ *    of its own that is pinned to a CPU, replays on its own copy of
+ *    the memlib heap and sends its results back over a pipe.
+ */
+static void run_traces(eval_funct eval, evaljob_t *job, int num_tracefiles,
+		       int njobs)
+{
+    struct pollfd *fds;
+    pid_t *pids;
+    int *traces;
+    int i, s, next, running, pipefd[2];
+
+    if (njobs <= 1) {
+	for (i = 0; i < num_tracefiles; i++)
+	    eval(job, i);
+	return;
+    }
+
+    /* Worker slot s runs trace traces[s] as process pids[s] */
+    if ((fds = calloc(njobs, sizeof(struct pollfd))) == NULL ||
+	(pids = calloc(njobs, sizeof(pid_t))) == NULL ||
+	(traces = calloc(njobs, sizeof(int))) == NULL)
+	unix_error("calloc in run_traces failed");
+    for (s = 0; s < njobs; s++)
+	fds[s].fd = -1;
+
+    next = running = 0;
+    while (next < num_tracefiles || running > 0) {
+	/* Start a worker in every free slot */
+	for (s = 0; s < njobs && next < num_tracefiles; s++) {
+	    if (fds[s].fd >= 0)
+		continue;
+	    if (pipe(pipefd) < 0)
+		unix_error("pipe in run_traces failed");
+	    fflush(stdout); /* or the worker prints it again */
+	    if ((pids[s] = fork()) < 0)
+		unix_error("fork in run_traces failed");
+	    if (pids[s] == 0) {
+		close(pipefd[0]);
+		run_job(eval, job, next, s, pipefd[1]);
+	    }
+	    close(pipefd[1]);
+	    fds[s].fd = pipefd[0];
+	    fds[s].events = POLLIN;
+	    traces[s] = next++;
+	    running++;
+	}
+
+	/* Then collect the results of the workers that are done */
+	if (poll(fds, njobs, -1) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("poll in run_traces failed");
+	}
+	for (s = 0; s < njobs; s++) {
+	    if (fds[s].fd < 0 || fds[s].revents == 0)
+		continue;
+	    if (!collect_job(job, traces[s], fds[s].fd)) {
+		printf("ERROR: the worker for trace %d failed\n", traces[s]);
+		errors++;
+	    }
+	    close(fds[s].fd);
+	    fds[s].fd = -1;
+	    waitpid(pids[s], NULL, 0);
+	    running--;
+	}
+    }
+    free(fds);
+    free(pids);
+    free(traces);
+}
+
+/*
+ * job_parts - Point parts[] at the results of trace tracenum in job's
+ *    arrays, and set sizes[] to their lengths. Returns how many there
+ *    are.
+ */
+static int job_parts(evaljob_t *job, int tracenum, void **parts, 
+		     size_t *sizes)
+{
+    int n = 0;
+
+    parts[n] = &job->stats[tracenum];
+    sizes[n++] = sizeof(stats_t);
+    if (job->counters != NULL) {
+	parts[n] = &job->counters[tracenum];
+	sizes[n++] = sizeof(mm_stats_t);
+    }
+    if (job->lat != NULL) {
+	parts[n] = &job->lat[tracenum * NUM_REQTYPES];
+	sizes[n++] = NUM_REQTYPES * sizeof(lathist_t);
+    }
+    if (job->mt != NULL) {
+	parts[n] = &job->mt[tracenum * MT_NUMCOUNTS];
+	sizes[n++] = MT_NUMCOUNTS * sizeof(mtstats_t);
+    }
+    return n;
+}
+
+/*
+ * run_job - The worker process for trace tracenum in slot: evaluate
+ *    it, write its error count and results to fd, and exit
+ */
+static void run_job(eval_funct eval, evaljob_t *job, int tracenum, 
+		    int slot, int fd)
+{
+    void *parts[4];
+    size_t sizes[4];
+    int i, n;
+    ssize_t w;
+    char *p;
+
+    pin_cpu(slot);
+    /* Counters opened before the fork count the parent */
+    if (run_hw) {
+	pc_close();
+	pc_open();
+    }
+    errors = 0;
+    eval(job, tracenum);
+
+    n = job_parts(job, tracenum, parts, sizes);
+    parts[n] = &errors;  /* last, so that a short message shows */
+    sizes[n++] = sizeof(errors);
+    for (i = 0; i < n; i++) {
+	for (p = parts[i]; sizes[i] > 0; p += w, sizes[i] -= w)
+	    if ((w = write(fd, p, sizes[i])) <= 0)
+		exit(1);
+    }
+    exit(0);
+}
+
+/*
+ * collect_job - Read the results of the worker for trace tracenum from
+ *    fd into job's arrays. Returns 0 if it died before sending them all.
+ */
+static int collect_job(evaljob_t *job, int tracenum, int fd)
+{
+    void *parts[4];
+    size_t sizes[4];
+    size_t total = sizeof(int), got = 0;
+    int i, n, errs;
+    ssize_t r;
+    char *buf, *p;
+
+    n = job_parts(job, tracenum, parts, sizes);
+    for (i = 0; i < n; i++)
+	total += sizes[i];
+    if ((buf = malloc(total)) == NULL)
+	unix_error("malloc in collect_job failed");
+    while (got < total && (r = read(fd, buf + got, total - got)) != 0) {
+	if (r < 0 && errno != EINTR)
+	    break;
+	if (r > 0)
+	    got += r;
+    }
+    if (got < total) {
+	free(buf);
+	return 0;
+    }
+
+    /* Nothing is kept from a worker that fell short */
+    for (i = 0, p = buf; i < n; p += sizes[i++])
+	memcpy(parts[i], p, sizes[i]);
+    memcpy(&errs, p, sizeof(errs));
+    errors += errs;
+    free(buf);
+    return 1;
+}
+
+/*
+ * pin_cpu - Keep this process on the slot'th CPU it may run on, so
+ *    that the workers of run_traces don't get in each other's way
+ */
+static void pin_cpu(int slot)
+{
+    cpu_set_t allowed, one;
+    int cpu, n;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0 ||
+	(n = CPU_COUNT(&allowed)) == 0)
+	return;
+    slot %= n;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	if (CPU_ISSET(cpu, &allowed) && slot-- == 0)
+	    break;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    sched_setaffinity(0, sizeof(one), &one);
+}
+
+/**********************************************************************
+ * The following functions replay a trace on several threads at once,
+ * to measure how the mm malloc package scales.
+ **********************************************************************/
+
+/*
+ * eval_mm_threads - Replay the trace on nthreads threads at the same
+ *    time, spread over them as directed by mode, and record the
+ *    aggregate and per-thread throughput of the fastest of MT_RUNS runs.
+ *    MT_REMOTE runs pairs of threads, so odd thread counts are skipped.
+ */
+static void eval_mm_threads(trace_t *trace, MtMode mode, int nthreads,
+			    mtstats_t *stats)
+{
+    pthread_t tids[MT_MAX_THREADS];
+    mtarg_t args[MT_MAX_THREADS];
+    mtring_t *rings = NULL;
+    pthread_barrier_t start;
+    double begin, end, secs, kops;
+    int run, t;
+
+    stats->threads = 0;
+    if (mode == MT_REMOTE && nthreads % 2 != 0)
+	return;
+
+    /* Set up the per-thread block arrays and the producer queues */
+    if (mode == MT_REMOTE &&
+	(rings = (mtring_t *)malloc((nthreads/2) * sizeof(mtring_t))) == NULL)
+	unix_error("malloc 1 failed in eval_mm_threads");
+    for (t = 0; t < nthreads; t++) {
+	args[t].trace = trace;
+	args[t].mode = mode;
+	args[t].id = t;
+	args[t].nthreads = nthreads;
+	args[t].ring = (rings != NULL) ? &rings[t/2] : NULL;
+	args[t].start = &start;
+	if ((args[t].blocks = 
+	     (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	    unix_error("malloc 2 failed in eval_mm_threads");
+    }
+
+    for (run = 0; run < MT_RUNS; run++) {
+	/* Reset the heap and initialize the mm package */
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_threads");
+	if (rings != NULL)
+	    memset(rings, 0, (nthreads/2) * sizeof(mtring_t));
+
+	/* 
+	 * Start all threads at once. The run lasts from the first thread
+	 * starting its requests until the last one is done with them.
+	 */
+	pthread_barrier_init(&start, NULL, nthreads);
+	for (t = 0; t < nthreads; t++) {
+	    if (pthread_create(&tids[t], NULL, mt_replay, &args[t]) != 0)
+		app_error("pthread_create failed in eval_mm_threads");
+	}
+	begin = DBL_MAX;
+	end = 0;
+	for (t = 0; t < nthreads; t++) {
+	    pthread_join(tids[t], NULL);
+	    if (args[t].begin < begin)
+		begin = args[t].begin;
+	    if (args[t].end > end)
+		end = args[t].end;
+	}
+	secs = end - begin;
+	pthread_barrier_destroy(&start);
+
+	if (stats->threads != 0 && secs >= stats->secs)
+	    continue;
+
+	/* Fastest run so far */
+	stats->threads = nthreads;
+	stats->secs = end - begin;
+	stats->ops = 0;
+	stats->min_kops = DBL_MAX;
+	stats->max_kops = 0;
+	for (t = 0; t < nthreads; t++) {
+	    stats->ops += args[t].ops;
+	    secs = args[t].end - args[t].begin;
+	    kops = (secs > 0) ? (args[t].ops/1e3)/secs : 0;
+	    if (kops < stats->min_kops)
+		stats->min_kops = kops;
+	    if (kops > stats->max_kops)
+		stats->max_kops = kops;
+	}
+    }
+
+    for (t = 0; t < nthreads; t++)
+	free(args[t].blocks);
+    free(rings);
+}
+
+/*
+ * mt_replay - Body of one replay thread. In MT_COPY mode it runs the
+ *    whole trace, in MT_SPLIT mode only the requests for the blocks
+ *    whose index maps to it. In MT_REMOTE mode even threads run the
+ *    whole trace but pass their frees to the next thread, which
+ *    performs them.
+ */
+static void *mt_replay(void *ptr)
+{
+    mtarg_t *arg = (mtarg_t *)ptr;
+    trace_t *trace = arg->trace;
+    char **blocks = arg->blocks;
+    int i, j, index, size, batch;
+    double ops = 0;
+    char *p;
+
+    pthread_barrier_wait(arg->start);
+    arg->begin = wall_secs();
+
+    if (arg->mode == MT_REMOTE && arg->id % 2 == 1) {
+	/* Consumer: free what the producer sends until it sends NULL */
+	while ((p = mt_pop(arg->ring)) != NULL) {
+	    mm_free(p);
+	    ops++;
+	}
+    }
+    else {
+	for (i = 0;  i < trace->num_ops;  i++) {
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    batch = trace->ops[i].type == ALLOC_BATCH || 
+		trace->ops[i].type == FREE_BATCH;
+	    if (arg->mode == MT_SPLIT && !batch && 
+		index % arg->nthreads != arg->id)
+		continue;
+
+	    switch (trace->ops[i].type) {
+
+	    case ALLOC: /* mm_malloc */
+	    case MEMALIGN: /* mm_memalign */
+	    case CALLOC: /* mm_calloc */
+		if ((p = (char *) mm_alloc_op(&trace->ops[i])) == NULL)
+		    app_error("mm_malloc error in mt_replay");
+		blocks[index] = p;
+		ops++;
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		if ((p = (char *) mm_realloc(blocks[index], size)) == NULL)
+		    app_error("mm_realloc error in mt_replay");
+		blocks[index] = p;
+		ops++;
+		break;
+
+	    case FREE: /* mm_free, here or on the consumer */
+		if (arg->mode == MT_REMOTE)
+		    mt_push(arg->ring, blocks[index]);
+		else {
+		    mm_free(blocks[index]);
+		    ops++;
+		}
+		break;
+
+	    case ALLOC_BATCH: /* mm_malloc_batch, or per block when split */
+	    case FREE_BATCH: /* mm_free_batch, or the consumer frees */
+		if (arg->mode == MT_COPY || 
+		    (arg->mode == MT_REMOTE && trace->ops[i].type == ALLOC_BATCH)) {
+		    if (!mm_batch_op(&trace->ops[i], blocks))
+			app_error("mm_malloc_batch error in mt_replay");
+		    ops += trace->ops[i].arg;
+		    break;
+		}
+		for (j = index; j < index + trace->ops[i].arg; j++) {
+		    if (arg->mode == MT_SPLIT && j % arg->nthreads != arg->id)
+			continue;
+		    if (trace->ops[i].type == FREE_BATCH && arg->mode == MT_REMOTE)
+			mt_push(arg->ring, blocks[j]);
+		    else if (trace->ops[i].type == FREE_BATCH) {
+			mm_free(blocks[j]);
+			ops++;
+		    }
+		    else {
+			if ((blocks[j] = (char *) mm_malloc(size)) == NULL)
+			    app_error("mm_malloc error in mt_replay");
+			ops++;
+		    }
+		}
+		break;
+
+	    default:
+		app_error("Nonexistent request type in mt_replay");
+	    }
 	}
+	if (arg->mode == MT_REMOTE)
+	    mt_push(arg->ring, NULL);
     }
+
+    arg->end = wall_secs();
+    arg->ops = ops;
+    return NULL;
+}
+
+/*
+ * mt_push - Queue block p for the consumer, waiting while the queue
+ *    is full
+ */
+static void mt_push(mtring_t *ring, char *p)
+{
+    unsigned int head = ring->head;
+
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == MT_RING)
+	sched_yield();
+    ring->slots[head % MT_RING] = p;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * mt_pop - Take the next block off the queue, waiting while it is empty
+ */
+static char *mt_pop(mtring_t *ring)
+{
+    unsigned int tail = ring->tail;
+    char *p;
+
+    while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+	sched_yield();
+    p = ring->slots[tail % MT_RING];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return p;
+}
+
+/*
+ * wall_secs - Return the current wall clock time in seconds
+ */
+static double wall_secs(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/**********************************************************************
+ * The following functions keep the per-request latency histograms
+ **********************************************************************/
+
+/* Cycles that reading the counter twice takes by itself */
+static unsigned long long lat_overhead = 0;
+
+/*
+ * lat_calibrate - Measure the cost of back-to-back counter reads, which
+ *    lat_record takes off every sample
+ */
+static void lat_calibrate(void)
+{
+    unsigned long long t0, d;
+    int i;
+
+    lat_overhead = ~0ULL;
+    for (i = 0; i < 1000; i++) {
+	t0 = read_counter();
+	d = read_counter() - t0;
+	if (d < lat_overhead)
+	    lat_overhead = d;
+    }
+}
+
+/*
+ * lat_record - Add a sample of the given number of cycles to h. Values
+ *    below 2^LAT_SUB_BITS get a bucket each; above that, the bucket is
+ *    given by the position of the top bit and the LAT_SUB_BITS below it.
+ */
+static void lat_record(lathist_t *h, unsigned long long cycles)
+{
+    int msb, b;
+
+    cycles = (cycles > lat_overhead) ? cycles - lat_overhead : 0;
+    if (cycles < (1 << LAT_SUB_BITS))
+	b = (int)cycles;
+    else {
+	msb = 63 - __builtin_clzll(cycles);
+	b = ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) |
+	    (int)((cycles >> (msb - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+    }
+    h->count[b]++;
+    h->n++;
+    if (cycles > h->max)
+	h->max = cycles;
+}
+
+/*
+ * lat_percentile - Return an upper bound on the p'th quantile (0 < p
+ *    <= 1) of the samples in h: the top of the bucket it falls in
+ */
+static unsigned long long lat_percentile(lathist_t *h, double p)
+{
+    unsigned long rank = (unsigned long)(p * h->n + 0.999999);
+    unsigned long seen = 0;
+    unsigned long long top;
+    int b, msb;
+
+    if (rank < 1)
+	rank = 1;
+    for (b = 0; b < LAT_BUCKETS; b++) {
+	seen += h->count[b];
+	if (seen >= rank)
+	    break;
+    }
+    if (b < (1 << LAT_SUB_BITS))
+	top = b;
+    else {
+	msb = (b >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+	top = (1ULL << msb) + 
+	    ((unsigned long long)((b & ((1 << LAT_SUB_BITS) - 1)) + 1) << 
+	     (msb - LAT_SUB_BITS)) - 1;
+    }
+    return (top < h->max) ? top : h->max;
+}
+
+/**********************************************************************
+ * The following functions write the fragmentation timeline of -F: one
+ * sample of the live payload and the heap's free blocks every
+ * frag_interval requests of eval_mm_util, as CSV or, if the file name
+ * ends in .json, as a JSON array of objects.
+ **********************************************************************/
+
+/*
+ * frag_open - Create the timeline file at path and write its header
+ */
+static void frag_open(char *path)
+{
+    size_t len = strlen(path);
+
+    if ((frag_file = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s for the fragmentation timeline", path);
+	unix_error(msg);
+    }
+    frag_json = (len >= 5 && !strcmp(path + len - 5, ".json"));
+    if (frag_json)
+	fprintf(frag_file, "[\n");
+    else
+	fprintf(frag_file, "trace,file,policy,op,live_bytes,heap_bytes,free_blocks,"
+		"free_bytes,largest_free,deferred_blocks,ext_frag\n");
+}
+
+/*
+ * frag_sample - Record the state of the heap after request opnum of
+ *    trace tracenum, with live_bytes of payload allocated, under the
+ *    placement policy in effect. The heap's size is its footprint, arena
+ *    0 plus the mapped blocks, as for utilization. External
+ *    fragmentation is 1 - largest free block / total free bytes.
+ */
+static void frag_sample(trace_t *trace, int tracenum, int opnum, 
+			int live_bytes)
+{
+    mm_stats_t st;
+    double ext_frag;
+    unsigned long heap_bytes = (unsigned long)(mem_heapsize() + mem_mapsize());
+
+    mm_stats(&st);
+    ext_frag = st.free_bytes ? 1.0 - (double)st.largest_free / st.free_bytes : 0.0;
+    if (frag_json)
+	fprintf(frag_file, "%s  {\"trace\": %d, \"file\": \"%s\", "
+		"\"policy\": \"%s\", \"op\": %d, "
+		"\"live_bytes\": %d, \"heap_bytes\": %lu, \"free_blocks\": %lu, "
+		"\"free_bytes\": %lu, \"largest_free\": %lu, "
+		"\"deferred_blocks\": %lu, \"ext_frag\": %.4f}",
+		frag_samples ? ",\n" : "",
+		tracenum, trace->filename, mm_policy(), opnum, live_bytes, 
+		heap_bytes, st.free_blocks,
+		(unsigned long)st.free_bytes, (unsigned long)st.largest_free,
+		st.deferred_blocks, ext_frag);
+    else
+	fprintf(frag_file, "%d,%s,%s,%d,%d,%lu,%lu,%lu,%lu,%lu,%.4f\n",
+		tracenum, trace->filename, mm_policy(), opnum, live_bytes, 
+		heap_bytes, st.free_blocks,
+		(unsigned long)st.free_bytes, (unsigned long)st.largest_free,
+		st.deferred_blocks, ext_frag);
+    frag_samples++;
+}
+
+/*
+ * frag_close - Finish and close the timeline file, if there is one
+ */
+static void frag_close(void)
+{
+    if (frag_file == NULL)
+	return;
+    if (frag_json)
+	fprintf(frag_file, "\n]\n");
+    fclose(frag_file);
+    frag_file = NULL;
 }
 
 /*************************************
@@ -987,6 +3098,177 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printmmstats - prints the statistics the mm package kept for each
+ *    valid trace during eval_mm_util
+ */
+static void printmmstats(int n, stats_t *stats, mm_stats_t *counters)
+{
+    mm_stats_t *c;
+    char coal[MAXLINE], re[MAXLINE], fr[MAXLINE], hp[MAXLINE];
+    int i;
+
+    printf("Statistics for mm malloc:\n");
+    if (n > 0 && !counters[0].counters)
+	printf("(build mm.c with -DMM_STATS for the event counters)\n");
+    printf("%5s%9s%8s%8s%24s%8s%8s%7s%16s%16s%20s\n", 
+	   "trace", "fits", "visits", "splits", "coalesce none/n/p/both",
+	   "extends", "ext KB", "trims", "realloc ip/cp", "free blks/max",
+	   "heap KB peak/final");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	c = &counters[i];
+	sprintf(coal, "%lu/%lu/%lu/%lu", 
+		c->coalesce[0], c->coalesce[1], c->coalesce[2], c->coalesce[3]);
+	sprintf(re, "%lu/%lu", c->realloc_inplace, c->realloc_copies);
+	sprintf(fr, "%lu/%lu", c->free_blocks, (unsigned long)c->largest_free);
+	sprintf(hp, "%lu/%lu", (unsigned long)stats[i].peak_heap / 1024,
+		(unsigned long)stats[i].final_heap / 1024);
+	printf("%2d%12lu%8.1f%8lu%24s%8lu%8lu%7lu%16s%16s%20s\n", 
+	       i,
+	       c->fit_searches,
+	       c->fit_searches ? (double)c->fit_visits / c->fit_searches : 0.0,
+	       c->splits,
+	       coal,
+	       c->extends,
+	       c->extend_bytes / 1024,
+	       c->trims,
+	       re,
+	       fr,
+	       hp);
+    }
+}
+
+/*
+ * printlatresults - prints the latency percentiles of each request
+ *    type for each trace, as collected by eval_mm_speed under -H
+ */
+static void printlatresults(int n, lathist_t *lat)
+{
+    lathist_t *h;
+    int i, t;
+
+#if defined(__i386__) || defined(__x86_64__) || defined(__alpha)
+    printf("Latency of mm malloc requests in cycles:\n");
+#else
+    printf("Latency of mm malloc requests in nanoseconds:\n");
+#endif
+    printf("%5s%14s%8s%8s%8s%8s%8s%10s\n", 
+	   "trace", "request", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (i=0; i < n; i++) {
+	for (t=0; t < NUM_REQTYPES; t++) {
+	    h = &lat[i * NUM_REQTYPES + t];
+	    if (h->n == 0)
+		continue;
+	    printf("%2d%17s%8lu%8llu%8llu%8llu%8llu%10llu\n", 
+		   i,
+		   req_names[t],
+		   h->n,
+		   lat_percentile(h, 0.50),
+		   lat_percentile(h, 0.90),
+		   lat_percentile(h, 0.99),
+		   lat_percentile(h, 0.999),
+		   h->max);
+	}
+    }
+}
+
+/*
+ * printtouchresults - prints the throughput of the mm malloc package
+ *    for each valid trace with and without the payloads touched (-T)
+ */
+static void printtouchresults(int n, stats_t *stats)
+{
+    int i;
+
+    printf("Results for mm malloc touching %.0f%% of each payload:\n",
+	   touch_frac*100.0);
+    printf("%5s%8s%10s%8s%10s%8s%9s\n", 
+	   "trace", "ops", "secs", "Kops", "touched", "Kops", "slowdown");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	printf("%2d%11.0f%10.6f%8.0f%10.6f%8.0f%8.2fx\n", 
+	       i,
+	       stats[i].ops,
+	       stats[i].secs,
+	       (stats[i].ops/1e3)/stats[i].secs,
+	       stats[i].touch_secs,
+	       (stats[i].ops/1e3)/stats[i].touch_secs,
+	       stats[i].touch_secs/stats[i].secs);
+    }
+}
+
+/*
+ * printhwresults - prints the hardware events per request of the mm
+ *    malloc package for each valid trace, as counted under -C, next
+ *    to its throughput. Events that couldn't be counted show as "-".
+ */
+static void printhwresults(int n, stats_t *stats)
+{
+    pc_counts_t *hw;
+    int i, e;
+
+    printf("Hardware events per request of mm malloc:\n");
+    printf("%5s%8s", "trace", "Kops");
+    for (e = 0; e < PC_NUM; e++)
+	printf("%14s", pc_name(e));
+    printf("%6s\n", "IPC");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	hw = &stats[i].hw;
+	printf("%2d%11.0f", i, (stats[i].ops/1e3)/stats[i].secs);
+	for (e = 0; e < PC_NUM; e++) {
+	    if (hw->valid[e])
+		printf("%14.2f", hw->count[e] / stats[i].ops);
+	    else
+		printf("%14s", "-");
+	}
+	if (hw->valid[PC_CYCLES] && hw->valid[PC_INSTRUCTIONS] && 
+	    hw->count[PC_CYCLES] > 0)
+	    printf("%6.2f\n", (double)hw->count[PC_INSTRUCTIONS] / 
+		   hw->count[PC_CYCLES]);
+	else
+	    printf("%6s\n", "-");
+    }
+}
+
+/*
+ * printmtresults - prints the scalability of the mm malloc package for
+ *    each trace and thread count, as measured by eval_mm_threads
+ */
+static void printmtresults(int n, MtMode mode, mtstats_t *stats)
+{
+    static const char *modes[] = {"copy", "split", "remote"};
+    mtstats_t *s;
+    int i, k;
+
+    printf("Results for mm malloc on several threads (%s mode):\n", 
+	   modes[mode]);
+    printf("%5s%8s%8s%10s%8s  %s\n", 
+	   "trace", "threads", "ops", "secs", "Kops", "Kops per thread");
+    for (i=0; i < n; i++) {
+	for (k=0; k < MT_NUMCOUNTS; k++) {
+	    s = &stats[i * MT_NUMCOUNTS + k];
+	    if (s->threads == 0) {
+		printf("%2d%11d%8s%10s%8s  %s\n", 
+		       i, mt_threads[k], "-", "-", "-", "-");
+		continue;
+	    }
+	    printf("%2d%11d%8.0f%10.6f%8.0f  %.0f..%.0f\n", 
+		   i,
+		   s->threads,
+		   s->ops,
+		   s->secs,
+		   (s->ops/1e3)/s->secs,
+		   s->min_kops,
+		   s->max_kops);
+	}
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1019,14 +3301,40 @@ void malloc_error(int tracenum, int opnum, const char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValHPC] [-f <file>] [-t <dir>] [-p <mode>]\n"
+	    "               [-F <file>] [-i <n>] [-T <frac>] [-j <n>]\n"
+	    "               [-B <n> [-J <file>] [-b <file>]]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-b <file>  Compare the -B results with the baseline <file>\n");
+    fprintf(stderr, "\t           written by -J, and exit 1 on a regression.\n");
+    fprintf(stderr, "\t-B <n>     Benchmark instead: the median and confidence\n");
+    fprintf(stderr, "\t           interval of <n> measurements of each trace\n");
+    fprintf(stderr, "\t           (not with -F).\n");
+    fprintf(stderr, "\t-C         Report hardware events per request (Linux).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
+    fprintf(stderr, "\t-F <file>  Write a fragmentation timeline to <file>, as JSON\n");
+    fprintf(stderr, "\t           if it ends in .json and as CSV otherwise.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Report latency percentiles of each request type.\n");
+    fprintf(stderr, "\t-i <n>     Sample the timeline every <n> requests (default %d).\n",
+	    FRAG_INTERVAL);
+    fprintf(stderr, "\t-J <file>  Write the -B results to <file> as JSON.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate <n> traces at once, each in a process of its\n");
+    fprintf(stderr, "\t           own pinned to a CPU (not with -p or -F).\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-P         Compare all placement policies of mm.c.\n");
+    fprintf(stderr, "\t-p <mode>  Also replay each trace on 1, 2, 4 and %d threads.\n",
+	    MT_MAX_THREADS);
+    fprintf(stderr, "\t           <mode> is copy (a copy of the trace per thread),\n");
+    fprintf(stderr, "\t           split (the trace's blocks divided among the\n");
+    fprintf(stderr, "\t           threads) or remote (pairs of threads, one\n");
+    fprintf(stderr, "\t           allocating and the other freeing).\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <frac>  Also time each trace writing and reading the first\n");
+    fprintf(stderr, "\t           <frac> (0 to 1) of every payload; with -P, time\n");
+    fprintf(stderr, "\t           the policies that way.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -1,8 +1,31 @@
 /*
- * memlib.c - a module that simulates the memory system.  Needed because it 
- *            allows us to interleave calls from the student's malloc package 
+ * memlib.c - a module that simulates the memory system.  Needed because it
+ *            allows us to interleave calls from the student's malloc package
  *            with the system's malloc package in libc.
+ *
+ *            The simulated memory consists of up to MAX_ARENAS independent
+ *            arenas, each a contiguous region with its own break pointer.
+ *            Arena 0 is created by mem_init and is what the classic
+ *            single-heap interface (mem_sbrk, mem_heap_lo, ...) operates
+ *            on; the others are created on demand by mem_arena_create.
+ *            All of them are carved out of one block of storage, arena 0
+ *            first, so every arena address is less than MEM_SPAN bytes
+ *            past mem_heap_lo(). The storage is reserved with mmap
+ *            rather than taken from libc, and only the pages the arenas
+ *            actually use ever get memory behind them.
+ *
+ *            Besides the arenas, mem_map hands out page-aligned regions
+ *            of their own, backed by real mmap. They count towards the
+ *            footprint (arena 0 plus all mappings) whose peak
+ *            mem_peak_footprint reports, and mem_reset_brk unmaps any
+ *            that are left. They are kept in a splay tree by address,
+ *            so finding the one an address lies in takes amortized
+ *            O(log n) time in the number of live mappings.
+ *
+ *            Nothing here calls malloc, so the module can serve as the
+ *            system's allocator itself (see mmshim.c).
  */
+#define _GNU_SOURCE            /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,86 +33,628 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* One simulated heap */
+typedef struct {
+    char *start_brk;       /* points to first byte of heap */
+    char *brk;             /* points to last byte of heap */
+    char *peak_brk;        /* highest brk since the last reset */
+    char *fresh_brk;       /* highest brk ever; the storage above it */
+                           /* has never been handed out and reads 0 */
+    char *max_addr;        /* largest legal heap address */
+    pthread_mutex_t lock;  /* guards brk */
+} mem_arena_t;
+
+/* One region handed out by mem_map, a node of the splay tree of them */
+typedef struct mem_map_s {
+    char *start;            /* first byte of the region, the tree's key */
+    size_t size;            /* its length, a multiple of the page size */
+    struct mem_map_s *left; /* mappings at lower addresses */
+    struct mem_map_s *right;/* at higher ones; links the spare records */
+} mem_map_t;
+
 /* private variables */
-char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_arena_t arenas[MAX_ARENAS];
+static char *mem_base;     /* the storage all arenas are carved out of */
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER; /* guards creation */
+
+static mem_map_t *maps;          /* root of the tree of live mappings */
+static mem_map_t *spare_maps;    /* unused mapping records */
+static size_t map_bytes;         /* their total size */
+static size_t peak_footprint;    /* largest arena 0 heap + map_bytes */
+static pthread_mutex_t maps_lock = PTHREAD_MUTEX_INITIALIZER; /* guards the above */
+
+static void unmap_all(void);
+static void note_footprint(void);
+
+/*
+ * arena_alloc - set up arena a on its share of the storage that models
+ *    the VM: MAX_HEAP bytes for arena 0, ARENA_HEAP for each other one
+ */
+static int arena_alloc(int a)
+{
+    mem_arena_t *ar = &arenas[a];
+    char *start;
+    size_t size;
+
+    if (mem_base == NULL)
+	return -1;
+    start = mem_base + (a ? MAX_HEAP + (size_t)(a - 1) * ARENA_HEAP : 0);
+    size = a ? ARENA_HEAP : MAX_HEAP;
+    ar->max_addr = start + size;  /* max legal heap address */
+    ar->brk = start;              /* heap is empty initially */
+    ar->peak_brk = start;
+    ar->fresh_brk = start;
+    pthread_mutex_init(&ar->lock, NULL);
+
+    /* Published last: mem_arena_of may be looking at the arena already */
+    __atomic_store_n(&ar->start_brk, start, __ATOMIC_RELEASE);
+    return 0;
+}
 
-/* 
+/*
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    /* 
+     * reserve the storage we will use to model the available VM,
+     * zero-filled like fresh VM. The arenas other than 0 are only
+     * touched once they are created.
+     */
+    mem_base = mmap(NULL, MEM_SPAN, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_base == MAP_FAILED || arena_alloc(0) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
-/* 
+/*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    int a;
+
+    for (a = 0; a < MAX_ARENAS; a++) {
+	if (arenas[a].start_brk != NULL) {
+	    pthread_mutex_destroy(&arenas[a].lock);
+	    arenas[a].start_brk = NULL;
+	}
+    }
+    munmap(mem_base, MEM_SPAN);
+    mem_base = NULL;
+    unmap_all();
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer of every arena to
+ *    make empty heaps
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    int a;
+
+    for (a = 0; a < MAX_ARENAS; a++) {
+	if (arenas[a].start_brk != NULL)
+	    arenas[a].brk = arenas[a].peak_brk = arenas[a].start_brk;
+    }
+    unmap_all();
+}
+
+/*
+ * mem_arena_create - create arena a with ARENA_HEAP bytes of storage,
+ *    unless it exists already. Returns 0 on success, -1 on error.
+ */
+int mem_arena_create(int a)
+{
+    int rc = 0;
+
+    if (a < 0 || a >= MAX_ARENAS)
+	return -1;
+    pthread_mutex_lock(&arenas_lock);
+    if (arenas[a].start_brk == NULL)
+	rc = arena_alloc(a);
+    pthread_mutex_unlock(&arenas_lock);
+    return rc;
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+/*
+ * mem_arena_sbrk - simple model of the sbrk function for arena a.
+ *    Extends the arena by incr bytes and returns the start address of
+ *    the new area, or for a negative incr shrinks it by -incr bytes and
+ *    returns the old break. Safe to call from several threads at once.
  */
-void *mem_sbrk(int incr) 
+void *mem_arena_sbrk(int a, ptrdiff_t incr)
 {
-    char *old_brk = mem_brk;
+    mem_arena_t *ar = &arenas[a];
+    char *old_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    pthread_mutex_lock(&ar->lock);
+    old_brk = ar->brk;
+    if (incr < 0 && -incr > ar->brk - ar->start_brk) {
+	pthread_mutex_unlock(&ar->lock);
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below the heap...\n");
+	return (void *)-1;
+    }
+    if (incr > ar->max_addr - ar->brk) {
+	pthread_mutex_unlock(&ar->lock);
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    ar->brk += incr;
+    if (ar->brk > ar->peak_brk)
+	ar->peak_brk = ar->brk;
+    if (ar->brk > ar->fresh_brk)
+	ar->fresh_brk = ar->brk;
+    pthread_mutex_unlock(&ar->lock);
+    if (a == 0 && incr > 0)
+	note_footprint();
     return (void *)old_brk;
 }
 
+/*
+ * mem_sbrk - mem_arena_sbrk on arena 0
+ */
+void *mem_sbrk(int incr)
+{
+    return mem_arena_sbrk(0, incr);
+}
+
+/*
+ * mem_arena_of - return the index of the arena that contains address
+ *    p, or -1 if p lies in none of them
+ */
+int mem_arena_of(void *p)
+{
+    int a;
+    char *start;
+
+    for (a = 0; a < MAX_ARENAS; a++) {
+	start = __atomic_load_n(&arenas[a].start_brk, __ATOMIC_ACQUIRE);
+	if (start != NULL && (char *)p >= start && (char *)p < arenas[a].max_addr)
+	    return a;
+    }
+    return -1;
+}
+
+/*
+ * mem_arena_lo - return address of the first byte of arena a
+ */
+void *mem_arena_lo(int a)
+{
+    return (void *)arenas[a].start_brk;
+}
+
+/*
+ * mem_arena_hi - return address of the last byte of arena a
+ */
+void *mem_arena_hi(int a)
+{
+    return (void *)(arenas[a].brk - 1);
+}
+
+/*
+ * mem_arena_heapsize - returns the size of arena a in bytes
+ */
+size_t mem_arena_heapsize(int a)
+{
+    return (size_t)(arenas[a].brk - arenas[a].start_brk);
+}
+
+/*
+ * mem_arena_peak_heapsize - returns the largest size arena a has had
+ *    since the last mem_reset_brk, in bytes
+ */
+size_t mem_arena_peak_heapsize(int a)
+{
+    return (size_t)(arenas[a].peak_brk - arenas[a].start_brk);
+}
+
+/*
+ * mem_arena_fresh - return the lowest address of arena a from which on
+ *    its storage has never been part of the heap, not even before the
+ *    last mem_reset_brk. Memory that mem_arena_sbrk hands out from
+ *    there is zero-filled, as a real sbrk's is.
+ */
+void *mem_arena_fresh(int a)
+{
+    mem_arena_t *ar = &arenas[a];
+    char *fresh;
+
+    pthread_mutex_lock(&ar->lock);
+    fresh = ar->fresh_brk;
+    pthread_mutex_unlock(&ar->lock);
+    return (void *)fresh;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_arena_lo(0);
 }
 
-/* 
+/*
  * mem_heap_hi - return address of last heap byte
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_arena_hi(0);
 }
 
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
-size_t mem_heapsize() 
+size_t mem_heapsize()
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_arena_heapsize(0);
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap size since the last
+ *    mem_reset_brk, in bytes
+ */
+size_t mem_peak_heapsize()
+{
+    return mem_arena_peak_heapsize(0);
+}
+
+/*
+ * note_footprint - raise peak_footprint to the current footprint.
+ *    Arena 0's break is read under its own lock, which mem_arena_sbrk
+ *    has released by the time it calls this.
+ */
+static void note_footprint(void)
+{
+    size_t size;
+
+    pthread_mutex_lock(&arenas[0].lock);
+    size = mem_arena_heapsize(0);
+    pthread_mutex_unlock(&arenas[0].lock);
+    pthread_mutex_lock(&maps_lock);
+    size += map_bytes;
+    if (size > peak_footprint)
+	peak_footprint = size;
+    pthread_mutex_unlock(&maps_lock);
+}
+
+/*
+ * unmap_all - unmap every live mapping and reset the footprint peak
+ */
+static void unmap_all(void)
+{
+    mem_map_t *m;
+
+    pthread_mutex_lock(&maps_lock);
+    while ((m = maps) != NULL) {
+	if (m->left != NULL) {
+	    /* Rotate right until the root has no left child */
+	    maps = m->left;
+	    m->left = maps->right;
+	    maps->right = m;
+	    continue;
+	}
+	maps = m->right;
+	munmap(m->start, m->size);
+	m->right = spare_maps;
+	spare_maps = m;
+    }
+    map_bytes = 0;
+    peak_footprint = 0;
+    pthread_mutex_unlock(&maps_lock);
+}
+
+/*
+ * new_map - take a mapping record off the spare list, refilling it a
+ *    page of records at a time, or return NULL if that fails. Called
+ *    with maps_lock held.
+ */
+static mem_map_t *new_map(void)
+{
+    size_t pagesize = mem_pagesize();
+    mem_map_t *m;
+    size_t i;
+
+    if (spare_maps == NULL) {
+	m = mmap(NULL, pagesize, PROT_READ | PROT_WRITE, 
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (m == MAP_FAILED)
+	    return NULL;
+	for (i = 0; i < pagesize / sizeof(mem_map_t); i++) {
+	    m[i].right = spare_maps;
+	    spare_maps = &m[i];
+	}
+    }
+    m = spare_maps;
+    spare_maps = m->right;
+    return m;
+}
+
+/*
+ * map_splay - top-down splay of the tree of mappings rooted at t around
+ *    address p. Returns the new root, which is the mapping that starts
+ *    at p if there is one, and otherwise a neighbour of p in address
+ *    order. This and the functions below are called with maps_lock
+ *    held.
+ */
+static mem_map_t *map_splay(mem_map_t *t, char *p)
+{
+    mem_map_t side, *l = &side, *r = &side, *y;
+
+    if (t == NULL)
+	return NULL;
+    side.left = side.right = NULL;
+    for (;;) {
+	if (p < t->start) {
+	    if ((y = t->left) == NULL)
+		break;
+	    if (p < y->start) {
+		t->left = y->right;
+		y->right = t;
+		t = y;
+		if (t->left == NULL)
+		    break;
+	    }
+	    r->left = t;
+	    r = t;
+	    t = t->left;
+	}
+	else if (p > t->start) {
+	    if ((y = t->right) == NULL)
+		break;
+	    if (p > y->start) {
+		t->right = y->left;
+		y->left = t;
+		t = y;
+		if (t->right == NULL)
+		    break;
+	    }
+	    l->right = t;
+	    l = t;
+	    t = t->right;
+	}
+	else
+	    break;
+    }
+    /* side.right is the tree of nodes below p, side.left those above */
+    l->right = t->left;
+    r->left = t->right;
+    t->left = side.right;
+    t->right = side.left;
+    return t;
+}
+
+/*
+ * find_map - return the mapping starting at p, now the root of the
+ *    tree, or NULL if there is none
+ */
+static mem_map_t *find_map(char *p)
+{
+    maps = map_splay(maps, p);
+    return (maps != NULL && maps->start == p) ? maps : NULL;
+}
+
+/*
+ * floor_map - return the mapping that starts closest below or at p,
+ *    or NULL if there is none
+ */
+static mem_map_t *floor_map(char *p)
+{
+    mem_map_t *t;
+
+    if ((t = maps = map_splay(maps, p)) == NULL || t->start <= p)
+	return t;
+    /* Everything left of the root lies below p; bring up its largest */
+    if (t->left != NULL)
+	t->left = map_splay(t->left, p);
+    return t->left;
+}
+
+/*
+ * insert_map - add mapping m to the tree, as its root
+ */
+static void insert_map(mem_map_t *m)
+{
+    mem_map_t *t = map_splay(maps, m->start);
+
+    if (t == NULL)
+	m->left = m->right = NULL;
+    else if (m->start < t->start) {
+	m->left = t->left;
+	m->right = t;
+	t->left = NULL;
+    }
+    else {
+	m->right = t->right;
+	m->left = t;
+	t->right = NULL;
+    }
+    maps = m;
+}
+
+/*
+ * remove_map - take mapping m, which find_map just returned, out of
+ *    the tree
+ */
+static void remove_map(mem_map_t *m)
+{
+    if (m->left == NULL)
+	maps = m->right;
+    else {
+	/* Splaying the left subtree around m's start leaves its largest
+	   node on top, with no right child */
+	maps = map_splay(m->left, m->start);
+	maps->right = m->right;
+    }
+}
+
+/*
+ * mem_map - map a fresh zero-filled region of at least size bytes,
+ *    rounded up to the page size. Returns its page-aligned start, or
+ *    NULL on error.
+ */
+void *mem_map(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    mem_map_t *m;
+    char *p;
+
+    size = (size + pagesize - 1) & ~(pagesize - 1);
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+	     -1, 0);
+    if (p == MAP_FAILED) {
+	fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+	return NULL;
+    }
+    pthread_mutex_lock(&maps_lock);
+    if ((m = new_map()) == NULL) {
+	pthread_mutex_unlock(&maps_lock);
+	munmap(p, size);
+	errno = ENOMEM;
+	return NULL;
+    }
+    m->start = p;
+    m->size = size;
+    insert_map(m);
+    map_bytes += size;
+    pthread_mutex_unlock(&maps_lock);
+    note_footprint();
+    return p;
+}
+
+/*
+ * mem_unmap - unmap the region at p that mem_map returned. Returns 0
+ *    on success, -1 if p starts no mapping.
+ */
+int mem_unmap(void *p)
+{
+    mem_map_t *m;
+    char *start;
+    size_t size;
+
+    pthread_mutex_lock(&maps_lock);
+    if ((m = find_map((char *)p)) == NULL) {
+	pthread_mutex_unlock(&maps_lock);
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_unmap failed. Not a mapping...\n");
+	return -1;
+    }
+    remove_map(m);
+    map_bytes -= m->size;
+    start = m->start;
+    size = m->size;
+    m->right = spare_maps;
+    spare_maps = m;
+    pthread_mutex_unlock(&maps_lock);
+    munmap(start, size);
+    return 0;
+}
+
+/*
+ * mem_remap - resize the region at p that mem_map returned to at least
+ *    size bytes, moving it if need be. The contents are kept up to the
+ *    smaller of the two sizes. Returns the region's new start, or NULL
+ *    on error, which leaves the old region alone.
+ */
+void *mem_remap(void *p, size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    mem_map_t *m;
+    char *newp;
+
+    size = (size + pagesize - 1) & ~(pagesize - 1);
+    pthread_mutex_lock(&maps_lock);
+    if ((m = find_map((char *)p)) == NULL) {
+	pthread_mutex_unlock(&maps_lock);
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_remap failed. Not a mapping...\n");
+	return NULL;
+    }
+    remove_map(m);
+    pthread_mutex_unlock(&maps_lock);
+
+    /* Only the caller uses this mapping, so m can't go away meanwhile.
+       It is out of the tree, since once mremap moves it another mapping
+       may start where it did. */
+#ifdef MREMAP_MAYMOVE
+    newp = mremap(m->start, m->size, size, MREMAP_MAYMOVE);
+#else
+    newp = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (newp != MAP_FAILED) {
+	memcpy(newp, m->start, m->size < size ? m->size : size);
+	munmap(m->start, m->size);
+    }
+#endif
+    pthread_mutex_lock(&maps_lock);
+    if (newp == MAP_FAILED) {
+	insert_map(m);
+	pthread_mutex_unlock(&maps_lock);
+	fprintf(stderr, "ERROR: mem_remap failed. Ran out of memory...\n");
+	return NULL;
+    }
+    map_bytes += size - m->size;
+    m->start = newp;
+    m->size = size;
+    insert_map(m);
+    pthread_mutex_unlock(&maps_lock);
+    note_footprint();
+    return newp;
+}
+
+/*
+ * mem_is_mapped - return 1 if the bytes lo through hi all lie in one
+ *    live mapping, and 0 otherwise
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    mem_map_t *m;
+    int found;
+
+    pthread_mutex_lock(&maps_lock);
+    m = floor_map((char *)lo);
+    found = m != NULL && (char *)hi < m->start + m->size &&
+	(char *)lo <= (char *)hi;
+    pthread_mutex_unlock(&maps_lock);
+    return found;
+}
+
+/*
+ * mem_mapsize - returns the total size of the live mappings in bytes
+ */
+size_t mem_mapsize(void)
+{
+    size_t size;
+
+    pthread_mutex_lock(&maps_lock);
+    size = map_bytes;
+    pthread_mutex_unlock(&maps_lock);
+    return size;
+}
+
+/*
+ * mem_peak_footprint - returns the largest size that arena 0 and the
+ *    live mappings have had together since the last mem_reset_brk,
+ *    in bytes
+ */
+size_t mem_peak_footprint(void)
+{
+    size_t size;
+
+    note_footprint();
+    pthread_mutex_lock(&maps_lock);
+    size = peak_footprint;
+    pthread_mutex_unlock(&maps_lock);
+    return size;
 }
 
 /*
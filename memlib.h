@@ -1,4 +1,5 @@
 #include <unistd.h>
+#include <stddef.h>
 
 void mem_init(void);               
 void mem_deinit(void);
@@ -7,5 +8,23 @@ void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
 size_t mem_pagesize(void);
 
+/* Independent arenas; the functions above operate on arena 0 */
+int mem_arena_create(int arena);
+void *mem_arena_sbrk(int arena, ptrdiff_t incr);
+int mem_arena_of(void *p);
+void *mem_arena_lo(int arena);
+void *mem_arena_hi(int arena);
+size_t mem_arena_heapsize(int arena);
+size_t mem_arena_peak_heapsize(int arena);
+void *mem_arena_fresh(int arena);
+
+/* Regions with a mapping of their own, outside every arena */
+void *mem_map(size_t size);
+int mem_unmap(void *p);
+void *mem_remap(void *p, size_t size);
+int mem_is_mapped(void *lo, void *hi);
+size_t mem_mapsize(void);
+size_t mem_peak_footprint(void);
@@ -5,6 +5,62 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+/*
+ * Aligned and zero-filled allocation. alignment must be a power of
+ * two; blocks from all three are freed and resized like any other.
+ */
+extern void *mm_memalign(size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+
+/*
+ * Batch allocation. mm_malloc_batch stores up to n blocks of size
+ * bytes in out and returns how many it got; mm_free_batch frees the n
+ * blocks in ptrs, which it leaves sorted by address.
+ */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* The number of payload bytes block ptr really has, at least its size */
+extern size_t mm_usable_size(void *ptr);
+
+/*
+ * Allocator statistics since the last mm_init, summed over all arenas.
+ * The event counters are only maintained when mm.c is compiled with
+ * -DMM_STATS, and read 0 otherwise. The free block figures are always
+ * computed, by walking the heap.
+ */
+typedef struct {
+    int counters;                 /* 1 if the event counters are live */
+    unsigned long fit_searches;   /* calls to find_fit */
+    unsigned long fit_visits;     /* free blocks examined by them */
+    unsigned long splits;         /* free blocks split by place */
+    unsigned long coalesce[4];    /* coalesce cases: neither neighbour */
+                                  /* free, next, previous, both */
+    unsigned long extends;        /* extend_heap calls */
+    unsigned long extend_bytes;   /* bytes they added to the heap */
+    unsigned long trims;          /* times the heap was trimmed */
+    unsigned long trim_bytes;     /* bytes that gave back */
+    unsigned long realloc_inplace;/* reallocs that kept their block */
+    unsigned long realloc_copies; /* reallocs that moved it */
+    unsigned long free_blocks;    /* free blocks in the heap */
+    size_t free_bytes;            /* their total size */
+    size_t largest_free;          /* the largest of them */
+    unsigned long deferred_blocks;/* freed blocks not yet coalesced */
+} mm_stats_t;
+
+extern void mm_stats(mm_stats_t *stats);
+
+/*
+ * Placement policies. mm_policy_name(i) names the i'th policy built
+ * into mm.c, or returns NULL past the last one. mm_set_policy selects
+ * one by name from the next mm_init on, and returns -1 if there is no
+ * such policy. mm_policy names the policy in effect.
+ */
+extern const char *mm_policy_name(int i);
+extern int mm_set_policy(const char *name);
+extern const char *mm_policy(void);
+
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, 
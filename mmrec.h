@@ -0,0 +1,39 @@
+/*
+ * mmrec.h - Format of the request logs that libmm.so records
+ *
+ * A log is a rec_header_t followed by fixed-size mmrec_t records, one
+ * per request that reached the mm package, in the host's byte order.
+ * Each thread writes its records in batches, so they are ordered by
+ * seq rather than by position in the file. type is the letter of the
+ * request in a .rep trace.
+ */
+#ifndef __MMREC_H_
+#define __MMREC_H_
+
+#define REC_MAGIC   "MMRC"  /* first four bytes of every log */
+#define REC_VERSION 1
+
+#define REC_MALLOC   'a'
+#define REC_FREE     'f'
+#define REC_REALLOC  'r'
+#define REC_MEMALIGN 'm'
+#define REC_CALLOC   'c'
+
+typedef struct {
+    char magic[4];              /* REC_MAGIC */
+    unsigned int version;       /* REC_VERSION */
+} rec_header_t;
+
+typedef struct {
+    unsigned long long seq;     /* position among all requests of the process */
+    unsigned long long addr;    /* block allocated, resized to or freed */
+    unsigned long long arg;     /* REC_REALLOC: the block resized, */
+                                /* REC_MEMALIGN: the alignment, */
+                                /* REC_CALLOC: the element count */
+    unsigned long long size;    /* bytes asked for (per element for */
+                                /* REC_CALLOC), 0 for REC_FREE */
+    unsigned int type;          /* REC_MALLOC ... REC_CALLOC */
+    unsigned int pad;
+} mmrec_t;
+
+#endif /* __MMREC_H_ */
@@ -0,0 +1,477 @@
+/*
+ * mmshim.c - Run the mm allocator under real programs
+ *
+ * Built as libmm.so ("make libmm.so"), this exports the libc allocation
+ * interface on top of mm.c and memlib.c, so that
+ *
+ *	unix> LD_PRELOAD=./libmm.so cc -c big.c
+ *
+ * runs the program with every malloc, free, realloc, calloc and
+ * memalign going to the mm package. memlib reserves its storage with
+ * mmap and never calls malloc itself, so the wrappers are all that
+ * libc's allocator is replaced by.
+ *
+ * The package is set up by the first allocation in the process. Any
+ * allocation made while that is under way (by the thread doing it, say
+ * from stdio) is served from a small static buffer instead, and blocks
+ * from there are never freed. free ignores pointers the mm package
+ * didn't hand out.
+ *
+ * When the program exits, the peak footprint and the free block
+ * statistics of the heap are written to stderr, or appended to the
+ * file named by $MM_SHIM_LOG.
+ *
+ * With $MM_SHIM_RECORD set, every request that reaches the mm package
+ * is also logged to $MM_SHIM_RECORD.<pid>, in the format of mmrec.h,
+ * for rec2rep to turn into a trace. Each thread collects its records
+ * in a buffer of its own and writes it out whole; a counter shared by
+ * all threads orders the requests. An allocation takes its number
+ * once it has its block and a free before it lets go of it, so a
+ * block's requests are always in order. Only a realloc that races
+ * with another thread reusing the block it gives up can be logged out
+ * of order; rec2rep copes with that.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+#include "mmrec.h"
+
+/* libmm.so is built with hidden visibility; only these are exported */
+#define EXPORT __attribute__((visibility("default")))
+
+#define BOOT_HEAP (64*1024)     /* bytes of the bootstrap buffer */
+#define BOOT_ALIGN 16           /* alignment of its blocks */
+
+/* The block header of a bootstrap block, holding its payload size */
+typedef union {
+    size_t size;
+    char pad[BOOT_ALIGN];
+} boot_hdr_t;
+
+static char boot_heap[BOOT_HEAP] __attribute__((aligned(BOOT_ALIGN)));
+static size_t boot_used;        /* bytes of boot_heap handed out */
+
+#define REC_BUF 256             /* records per thread buffer */
+
+/* One thread's records that haven't been written yet */
+typedef struct rec_buf_s {
+    struct rec_buf_s *next;     /* all threads' buffers */
+    struct rec_buf_s *prev;
+    int n;                      /* records in recs */
+    mmrec_t recs[REC_BUF];
+} rec_buf_t;
+
+static int rec_fd = -1;         /* the log, if recording */
+static unsigned long long rec_seq; /* number of the next request */
+static rec_buf_t *rec_bufs;     /* buffers of the live threads */
+static pthread_mutex_t rec_lock = PTHREAD_MUTEX_INITIALIZER; /* guards rec_bufs */
+static pthread_key_t rec_key;   /* flushes a buffer on thread exit */
+static __thread rec_buf_t *rec_buf; /* this thread's buffer */
+
+static void rec_init(void);
+
+static pthread_once_t shim_once = PTHREAD_ONCE_INIT;
+static int shim_ready;          /* set once the mm package is up */
+static __thread int shim_busy;  /* this thread is setting it up */
+
+/*
+ * shim_init - Set up memlib and the mm package, once per process
+ */
+static void shim_init(void)
+{
+    shim_busy = 1;
+    mem_init();
+    if (mm_init() < 0) {
+	static const char msg[] = "libmm: mm_init failed\n";
+	write(2, msg, sizeof(msg) - 1);
+	abort();
+    }
+    if (getenv("MM_SHIM_RECORD") != NULL)
+	rec_init();
+    __atomic_store_n(&shim_ready, 1, __ATOMIC_RELEASE);
+    shim_busy = 0;
+}
+
+/*
+ * shim_up - Bring the mm package up unless it is already. Returns 0 if
+ *    the calling thread is in the middle of doing so, in which case the
+ *    request has to be served from the bootstrap buffer.
+ */
+static inline int shim_up(void)
+{
+    if (__atomic_load_n(&shim_ready, __ATOMIC_ACQUIRE))
+	return 1;
+    if (shim_busy)
+	return 0;
+    pthread_once(&shim_once, shim_init);
+    return 1;
+}
+
+/*
+ * boot_alloc - Allocate size bytes from the bootstrap buffer, or
+ *    return NULL once it is used up
+ */
+static void *boot_alloc(size_t size)
+{
+    size_t need, old;
+    boot_hdr_t *h;
+
+    if (size > BOOT_HEAP)
+	return NULL;
+    need = sizeof(boot_hdr_t) + ((size + BOOT_ALIGN - 1) & ~(size_t)(BOOT_ALIGN - 1));
+    old = __atomic_fetch_add(&boot_used, need, __ATOMIC_RELAXED);
+    if (old + need > BOOT_HEAP)
+	return NULL;
+    h = (boot_hdr_t *)(boot_heap + old);
+    h->size = size;
+    return h + 1;
+}
+
+static inline int is_boot(void *p)
+{
+    return (char *)p >= boot_heap && (char *)p < boot_heap + BOOT_HEAP;
+}
+
+static inline size_t boot_size(void *p)
+{
+    return ((boot_hdr_t *)p - 1)->size;
+}
+
+/*
+ * is_mm - Return true if p is a block of the mm package
+ */
+static inline int is_mm(void *p)
+{
+    return mem_arena_of(p) >= 0 || mem_is_mapped(p, p);
+}
+
+/*
+ * rec_open - Start the log of this process. Returns the descriptor, or
+ *    -1 if it can't be created.
+ */
+static int rec_open(void)
+{
+    char path[PATH_MAX];
+    rec_header_t hdr;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s.%d", getenv("MM_SHIM_RECORD"), (int)getpid());
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0)
+	return -1;
+    memcpy(hdr.magic, REC_MAGIC, sizeof(hdr.magic));
+    hdr.version = REC_VERSION;
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+	close(fd);
+	return -1;
+    }
+    return fd;
+}
+
+/*
+ * rec_flush - Write out and empty buffer b. Called with rec_lock held.
+ */
+static void rec_flush(rec_buf_t *b)
+{
+    int fd = __atomic_load_n(&rec_fd, __ATOMIC_RELAXED);
+    size_t len = b->n * sizeof(mmrec_t);
+
+    if (fd >= 0 && write(fd, b->recs, len) != (ssize_t)len) {
+	static const char msg[] = "libmm: writing the request log failed\n";
+	len = write(2, msg, sizeof(msg) - 1);
+    }
+    __atomic_store_n(&b->n, 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * rec_exit - Thread exit hook: flush the thread's buffer and drop it
+ */
+static void rec_exit(void *arg)
+{
+    rec_buf_t *b = arg;
+
+    pthread_mutex_lock(&rec_lock);
+    rec_flush(b);
+    if (b->prev != NULL)
+	b->prev->next = b->next;
+    else
+	rec_bufs = b->next;
+    if (b->next != NULL)
+	b->next->prev = b->prev;
+    pthread_mutex_unlock(&rec_lock);
+    rec_buf = NULL;
+    munmap(b, sizeof(rec_buf_t));
+}
+
+/*
+ * rec_child - After a fork, give the child a log of its own. The
+ *    records buffered so far belong to the parent, which writes them.
+ */
+static void rec_child(void)
+{
+    pthread_mutex_init(&rec_lock, NULL);
+    close(rec_fd);
+    rec_fd = rec_open();
+    rec_bufs = rec_buf;
+    if (rec_buf != NULL) {
+	rec_buf->next = rec_buf->prev = NULL;
+	rec_buf->n = 0;
+    }
+}
+
+/*
+ * rec_init - Start recording, from shim_init
+ */
+static void rec_init(void)
+{
+    if ((rec_fd = rec_open()) < 0) {
+	static const char msg[] = "libmm: can't create the request log\n";
+	write(2, msg, sizeof(msg) - 1);
+	return;
+    }
+    pthread_key_create(&rec_key, rec_exit);
+    pthread_atfork(NULL, NULL, rec_child);
+}
+
+/*
+ * rec_finish - Stop recording and write out every thread's buffer, at
+ *    exit. Threads that are still running by then may lose the
+ *    requests they make meanwhile, or log one twice.
+ */
+static void rec_finish(void)
+{
+    rec_buf_t *b;
+    int fd = rec_fd;
+
+    pthread_mutex_lock(&rec_lock);
+    for (b = rec_bufs; b != NULL; b = b->next)
+	rec_flush(b);
+    __atomic_store_n(&rec_fd, -1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&rec_lock);
+    close(fd);
+}
+
+/*
+ * record - Log a request, if recording
+ */
+static inline void record(unsigned int type, void *addr,
+			  unsigned long long arg, size_t size)
+{
+    rec_buf_t *b = rec_buf;
+    mmrec_t *r;
+
+    if (__atomic_load_n(&rec_fd, __ATOMIC_RELAXED) < 0)
+	return;
+    if (b == NULL) {
+	b = mmap(NULL, sizeof(rec_buf_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b == MAP_FAILED)
+	    return;
+	pthread_mutex_lock(&rec_lock);
+	b->prev = NULL;
+	b->next = rec_bufs;
+	if (rec_bufs != NULL)
+	    rec_bufs->prev = b;
+	rec_bufs = b;
+	pthread_mutex_unlock(&rec_lock);
+	rec_buf = b;
+	pthread_setspecific(rec_key, b);
+    }
+
+    r = &b->recs[b->n];
+    r->seq = __atomic_fetch_add(&rec_seq, 1, __ATOMIC_RELAXED);
+    r->addr = (unsigned long long)(size_t)addr;
+    r->arg = arg;
+    r->size = size;
+    r->type = type;
+    r->pad = 0;
+    /* rec_finish may be reading n from another thread */
+    __atomic_store_n(&b->n, b->n + 1, __ATOMIC_RELEASE);
+    if (b->n == REC_BUF) {
+	pthread_mutex_lock(&rec_lock);
+	rec_flush(b);
+	pthread_mutex_unlock(&rec_lock);
+    }
+}
+
+/*
+ * The exported interface. Zero-byte requests get a block of their own,
+ * as with libc, and failures set errno.
+ */
+EXPORT void *malloc(size_t size)
+{
+    void *p;
+
+    if (!shim_up())
+	return boot_alloc(size);
+    if ((p = mm_malloc(size ? size : 1)) == NULL)
+	errno = ENOMEM;
+    else
+	record(REC_MALLOC, p, 0, size ? size : 1);
+    return p;
+}
+
+EXPORT void free(void *p)
+{
+    if (p == NULL || is_boot(p))
+	return;
+    if (!shim_ready || !is_mm(p))
+	return;
+    record(REC_FREE, p, 0, 0);
+    mm_free(p);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (nmemb != 0 && (nmemb * size) / nmemb != size) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (!shim_up())
+	return boot_alloc(nmemb * size);
+    /* The bootstrap buffer is never reused, so it is still zero */
+    if (nmemb == 0 || size == 0)
+	return malloc(1);
+    if ((p = mm_calloc(nmemb, size)) == NULL)
+	errno = ENOMEM;
+    else
+	record(REC_CALLOC, p, nmemb, size);
+    return p;
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    if (is_boot(ptr) || !shim_up()) {
+	/* Bootstrap blocks move to the mm package as soon as it is up */
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, boot_size(ptr) < size ? boot_size(ptr) : size);
+	return p;
+    }
+    if ((p = mm_realloc(ptr, size)) == NULL)
+	errno = ENOMEM;
+    else
+	record(REC_REALLOC, p, (unsigned long long)(size_t)ptr, size);
+    return p;
+}
+
+EXPORT void *memalign(size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+    if (!shim_up())
+	return alignment <= BOOT_ALIGN ? boot_alloc(size) : NULL;
+    if ((p = mm_memalign(alignment, size ? size : 1)) == NULL)
+	errno = ENOMEM;
+    else
+	record(REC_MEMALIGN, p, alignment, size ? size : 1);
+    return p;
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment % sizeof(void *) != 0 ||
+	(alignment & (alignment - 1)) != 0)
+	return EINVAL;
+    if ((p = memalign(alignment, size)) == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+EXPORT void *valloc(size_t size)
+{
+    return memalign(mem_pagesize(), size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+
+    return memalign(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *p)
+{
+    if (p == NULL)
+	return 0;
+    if (is_boot(p))
+	return boot_size(p);
+    return shim_ready && is_mm(p) ? mm_usable_size(p) : 0;
+}
+
+/*
+ * shim_report - Write the statistics of the heap when the program
+ *    exits. snprintf into a buffer of our own and write(2) keep stdio,
+ *    which may be shut down by now, out of it.
+ */
+__attribute__((destructor))
+static void shim_report(void)
+{
+    char buf[1024];
+    mm_stats_t st;
+    size_t heap = 0;
+    const char *log;
+    int fd = 2, n, a;
+
+    if (!shim_ready)
+	return;
+    if (rec_fd >= 0)
+	rec_finish();
+    mm_stats(&st);
+    for (a = 0; a < MAX_ARENAS; a++) {
+	if (mem_arena_lo(a) != NULL)
+	    heap += mem_arena_heapsize(a);
+    }
+    n = snprintf(buf, sizeof(buf),
+		 "libmm: pid %d: peak footprint %zu KB, heap %zu KB, "
+		 "mapped %zu KB, free blocks %lu (%zu KB, largest %zu KB)\n",
+		 (int)getpid(), mem_peak_footprint() / 1024, heap / 1024,
+		 mem_mapsize() / 1024, st.free_blocks, st.free_bytes / 1024,
+		 st.largest_free / 1024);
+    if (st.counters && n < (int)sizeof(buf))
+	n += snprintf(buf + n, sizeof(buf) - n,
+		      "libmm: fits %lu (%lu visits), splits %lu, "
+		      "extends %lu, trims %lu, realloc in place %lu, copied %lu\n",
+		      st.fit_searches, st.fit_visits, st.splits, st.extends,
+		      st.trims, st.realloc_inplace, st.realloc_copies);
+    if (n > (int)sizeof(buf) - 1)
+	n = sizeof(buf) - 1;
+
+    if ((log = getenv("MM_SHIM_LOG")) != NULL &&
+	(fd = open(log, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0)
+	fd = 2;
+    n = write(fd, buf, n);      /* nothing to be done if it fails */
+    if (fd != 2)
+	close(fd);
+}
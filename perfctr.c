@@ -0,0 +1,149 @@
+/*
+ * perfctr.c - Hardware performance counters through perf_event_open
+ *
+ * Each event gets a counter of its own rather than joining a group, so
+ * that one the CPU lacks doesn't take the others down with it. When
+ * there are more events than hardware counters the kernel time-slices
+ * them; pc_stop scales each count by the share of time it ran.
+ */
+#include <string.h>
+#include <errno.h>
+
+#include "perfctr.h"
+
+static const char *pc_names[PC_NUM] =
+    {"cycles", "instructions", "cache-misses", "dTLB-misses",
+     "branch-misses"};
+
+const char *pc_name(int i)
+{
+    return pc_names[i];
+}
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static int pc_fds[PC_NUM] = {-1, -1, -1, -1, -1};
+
+/*
+ * pc_attr - Fill in the attributes of event i
+ */
+static void pc_attr(struct perf_event_attr *attr, int i)
+{
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->disabled = 1;
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr->type = PERF_TYPE_HARDWARE;
+    switch (i) {
+    case PC_CYCLES:
+	attr->config = PERF_COUNT_HW_CPU_CYCLES;
+	break;
+    case PC_INSTRUCTIONS:
+	attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+	break;
+    case PC_CACHE_MISSES:
+	attr->config = PERF_COUNT_HW_CACHE_MISSES;
+	break;
+    case PC_DTLB_MISSES:
+	attr->type = PERF_TYPE_HW_CACHE;
+	attr->config = PERF_COUNT_HW_CACHE_DTLB |
+	    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	break;
+    default:
+	attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+	break;
+    }
+}
+
+int pc_open(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0, err = 0;
+
+    for (i = 0; i < PC_NUM; i++) {
+	pc_attr(&attr, i);
+	pc_fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (pc_fds[i] >= 0)
+	    n++;
+	else if (err == 0)
+	    err = errno;
+    }
+    if (n == 0)
+	errno = err;
+    return n;
+}
+
+void pc_start(void)
+{
+    int i;
+
+    for (i = 0; i < PC_NUM; i++) {
+	if (pc_fds[i] < 0)
+	    continue;
+	ioctl(pc_fds[i], PERF_EVENT_IOC_RESET, 0);
+	ioctl(pc_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void pc_stop(pc_counts_t *counts)
+{
+    unsigned long long buf[3]; /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PC_NUM; i++)
+	if (pc_fds[i] >= 0)
+	    ioctl(pc_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (i = 0; i < PC_NUM; i++) {
+	counts->valid[i] = 0;
+	counts->count[i] = 0;
+	if (pc_fds[i] < 0 ||
+	    read(pc_fds[i], buf, sizeof(buf)) != sizeof(buf) || buf[2] == 0)
+	    continue;
+	counts->valid[i] = 1;
+	counts->count[i] = buf[1] == buf[2] ? buf[0] :
+	    (unsigned long long)((double)buf[0] * buf[1] / buf[2]);
+    }
+}
+
+void pc_close(void)
+{
+    int i;
+
+    for (i = 0; i < PC_NUM; i++) {
+	if (pc_fds[i] >= 0)
+	    close(pc_fds[i]);
+	pc_fds[i] = -1;
+    }
+}
+
+#else /* !__linux__ */
+
+int pc_open(void)
+{
+    errno = ENOSYS;
+    return 0;
+}
+
+void pc_start(void)
+{
+}
+
+void pc_stop(pc_counts_t *counts)
+{
+    memset(counts, 0, sizeof(*counts));
+}
+
+void pc_close(void)
+{
+}
+
+#endif /* __linux__ */
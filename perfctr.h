@@ -0,0 +1,43 @@
+/*
+ * perfctr.h - Hardware performance counters over a stretch of code
+ *
+ * On Linux the counters are opened with perf_event_open, for user-mode
+ * events of the calling thread only. Events the kernel or the CPU
+ * doesn't support are left out; elsewhere none are available.
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+/* The events counted, in the order of pc_counts_t.count */
+#define PC_CYCLES        0
+#define PC_INSTRUCTIONS  1
+#define PC_CACHE_MISSES  2   /* last level cache */
+#define PC_DTLB_MISSES   3   /* data TLB, loads */
+#define PC_BRANCH_MISSES 4
+#define PC_NUM           5
+
+typedef struct {
+    int valid[PC_NUM];                 /* was the event counted? */
+    unsigned long long count[PC_NUM];  /* its count, scaled up if the */
+                                       /* kernel multiplexed it */
+} pc_counts_t;
+
+/*
+ * pc_open - Open the counters. Returns the number of events that can
+ *     be counted, and if none, sets errno to why the first one failed.
+ */
+int pc_open(void);
+
+/* pc_start - Zero the open counters and start them */
+void pc_start(void);
+
+/* pc_stop - Stop the counters and read them into counts */
+void pc_stop(pc_counts_t *counts);
+
+/* pc_close - Close the counters */
+void pc_close(void);
+
+/* pc_name - Short name of event i, PC_CYCLES..PC_NUM-1 */
+const char *pc_name(int i);
+
+#endif /* __PERFCTR_H_ */
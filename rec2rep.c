@@ -0,0 +1,310 @@
+/*
+ * rec2rep.c - Convert a request log recorded by libmm.so (mmrec.h)
+ *             into a text .rep trace for mdriver
+ *
+ * Usage: rec2rep <log> <out.rep>
+ *
+ * The records are put back in seq order, and the addresses they name
+ * are renamed to block ids. An id is reused as soon as its block is
+ * freed, so num_ids is the peak number of live blocks rather than the
+ * number of requests. Requests a trace cannot express are dropped: a
+ * free of a block allocated before recording started (or by the
+ * bootstrap buffer), and sizes beyond what a .rep field holds. A
+ * realloc of such a block turns into a malloc, and the blocks still
+ * live at the end of the log are freed, so the trace is balanced.
+ *
+ * A realloc is logged after it returns, so another thread can be
+ * handed the old block in between. The log then shows the block
+ * allocated while still live; the stale id is freed first, and the
+ * realloc that follows resizes the wrong block. This is rare, and
+ * only ever costs one copy in the replay.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "mmrec.h"
+
+typedef struct {
+    char type;
+    int index;
+    int arg;
+    int size;
+} op_t;
+
+/* The converted trace */
+static op_t *ops = NULL;
+static int num_ops = 0;
+static int max_ops = 0;
+
+/* Open-addressed table from live addresses to ids; addr 0 is empty */
+typedef struct {
+    unsigned long long addr;
+    int id;
+} slot_t;
+
+static slot_t *table = NULL;
+static size_t table_mask = 0;
+
+/* Bytes each id holds, and the ids free for reuse */
+static double *id_bytes = NULL;
+static int *free_ids = NULL;
+static int num_free = 0;
+static int num_ids = 0;
+static int max_ids = 0;
+static double live_bytes = 0, max_live = 0;
+
+static void unix_error(const char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+static void app_error(const char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+/*
+ * read_log - Read the records of log path, and return how many there are
+ */
+static size_t read_log(const char *path, mmrec_t **recs)
+{
+    FILE *fp;
+    rec_header_t hdr;
+    size_t n = 0, max = 0, got;
+
+    if ((fp = fopen(path, "rb")) == NULL)
+	unix_error(path);
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	memcmp(hdr.magic, REC_MAGIC, sizeof(hdr.magic)) != 0)
+	app_error("not a request log");
+    if (hdr.version != REC_VERSION)
+	app_error("unsupported request log version");
+
+    *recs = NULL;
+    do {
+	if (n == max) {
+	    max = max ? 2*max : 4096;
+	    if ((*recs = realloc(*recs, max * sizeof(mmrec_t))) == NULL)
+		app_error("out of memory");
+	}
+	got = fread(*recs + n, sizeof(mmrec_t), max - n, fp);
+	n += got;
+    } while (n == max);
+    if (ferror(fp))
+	unix_error("fread of request log");
+    /* A partial record means the log was cut short, or is not one */
+    if (fgetc(fp) != EOF)
+	app_error("request log is truncated");
+    fclose(fp);
+    return n;
+}
+
+static int seq_cmp(const void *a, const void *b)
+{
+    unsigned long long x = ((const mmrec_t *)a)->seq;
+    unsigned long long y = ((const mmrec_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+static void emit(char type, int index, int arg, int size)
+{
+    if (num_ops == max_ops) {
+	max_ops = max_ops ? 2*max_ops : 4096;
+	if ((ops = realloc(ops, max_ops * sizeof(op_t))) == NULL)
+	    app_error("out of memory");
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].index = index;
+    ops[num_ops].arg = arg;
+    ops[num_ops].size = size;
+    num_ops++;
+}
+
+/*
+ * lookup - Return the slot of addr, or the empty slot it would go in
+ */
+static slot_t *lookup(unsigned long long addr)
+{
+    size_t i = (size_t)((addr >> 3) * 0x9e3779b97f4a7c15ULL) & table_mask;
+
+    while (table[i].addr != 0 && table[i].addr != addr)
+	i = (i + 1) & table_mask;
+    return &table[i];
+}
+
+/*
+ * unmap - Empty slot s, moving later slots of its run back so that
+ *    lookups need no tombstones
+ */
+static void unmap(slot_t *s)
+{
+    size_t i = s - table, j = i, home;
+
+    for (;;) {
+	table[i].addr = 0;
+	do {
+	    j = (j + 1) & table_mask;
+	    if (table[j].addr == 0)
+		return;
+	    home = (size_t)((table[j].addr >> 3) * 0x9e3779b97f4a7c15ULL)
+		& table_mask;
+	    /* Stay put if home lies cyclically in (i, j] */
+	} while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+	table[i] = table[j];
+	i = j;
+    }
+}
+
+/*
+ * new_id - Give addr a fresh id holding bytes bytes
+ */
+static int new_id(unsigned long long addr, double bytes)
+{
+    slot_t *s = lookup(addr);
+    int id;
+
+    if (num_free > 0)
+	id = free_ids[--num_free];
+    else {
+	if (num_ids == max_ids) {
+	    max_ids = max_ids ? 2*max_ids : 4096;
+	    if ((id_bytes = realloc(id_bytes, max_ids * sizeof(double))) == NULL ||
+		(free_ids = realloc(free_ids, max_ids * sizeof(int))) == NULL)
+		app_error("out of memory");
+	}
+	id = num_ids++;
+    }
+    s->addr = addr;
+    s->id = id;
+    id_bytes[id] = bytes;
+    live_bytes += bytes;
+    if (live_bytes > max_live)
+	max_live = live_bytes;
+    return id;
+}
+
+/*
+ * drop_id - Free the id in slot s and emit its free
+ */
+static void drop_id(slot_t *s)
+{
+    int id = s->id;
+
+    emit('f', id, 0, 0);
+    live_bytes -= id_bytes[id];
+    free_ids[num_free++] = id;
+    unmap(s);
+}
+
+/*
+ * convert - Turn one record into trace requests
+ */
+static void convert(const mmrec_t *r)
+{
+    slot_t *s;
+    unsigned long long bytes = r->size;
+    int id;
+
+    if (r->type == REC_FREE) {
+	if ((s = lookup(r->addr))->addr != 0)
+	    drop_id(s);
+	return;
+    }
+    if (r->addr == 0 || r->size > INT_MAX)
+	return;
+    if (r->type == REC_CALLOC) {
+	if (r->arg == 0 || r->size > INT_MAX / r->arg)
+	    return;
+	bytes = r->arg * r->size;
+    }
+    else if (r->type == REC_MEMALIGN && r->arg > INT_MAX)
+	return;
+
+    if (r->type == REC_REALLOC && (s = lookup(r->arg))->addr != 0) {
+	id = s->id;
+	live_bytes -= id_bytes[id];
+	unmap(s);
+	/* The block may have moved onto a live address (see above) */
+	if ((s = lookup(r->addr))->addr != 0)
+	    drop_id(s);
+	s = lookup(r->addr);
+	s->addr = r->addr;
+	s->id = id;
+	id_bytes[id] = (double)bytes;
+	live_bytes += (double)bytes;
+	if (live_bytes > max_live)
+	    max_live = live_bytes;
+	emit('r', id, 0, (int)r->size);
+	return;
+    }
+
+    /* An address can only come back after its free was lost */
+    if ((s = lookup(r->addr))->addr != 0)
+	drop_id(s);
+    id = new_id(r->addr, (double)bytes);
+    if (r->type == REC_MEMALIGN || r->type == REC_CALLOC)
+	emit((char)r->type, id, (int)r->arg, (int)r->size);
+    else
+	emit('a', id, 0, (int)r->size);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *out;
+    mmrec_t *recs;
+    size_t n, i, j, cap;
+
+    if (argc != 3) {
+	fprintf(stderr, "Usage: %s <log> <out.rep>\n", argv[0]);
+	exit(1);
+    }
+    n = read_log(argv[1], &recs);
+
+    /* A thread exiting during rec_finish may have logged records twice */
+    qsort(recs, n, sizeof(mmrec_t), seq_cmp);
+    for (i = j = 0; i < n; i++)
+	if (j == 0 || recs[i].seq != recs[j-1].seq)
+	    recs[j++] = recs[i];
+    n = j;
+
+    for (cap = 1024; cap < 2*n; cap *= 2)
+	;
+    if ((table = calloc(cap, sizeof(slot_t))) == NULL)
+	app_error("out of memory");
+    table_mask = cap - 1;
+
+    for (i = 0; i < n; i++)
+	convert(&recs[i]);
+    for (i = 0; i < cap; i++)
+	if (table[i].addr != 0)
+	    emit('f', table[i].id, 0, 0);
+
+    if ((out = fopen(argv[2], "w")) == NULL)
+	unix_error(argv[2]);
+    /* Header: suggested heap size, ids, requests, weight */
+    fprintf(out, "%.0f\n%d\n%d\n1\n", max_live, num_ids, num_ops);
+    for (i = 0; i < (size_t)num_ops; i++) {
+	if (ops[i].type == 'f')
+	    fprintf(out, "f %d\n", ops[i].index);
+	else if (ops[i].type == 'm' || ops[i].type == 'c')
+	    fprintf(out, "%c %d %d %d\n", ops[i].type, ops[i].index,
+		    ops[i].arg, ops[i].size);
+	else
+	    fprintf(out, "%c %d %d\n", ops[i].type, ops[i].index,
+		    ops[i].size);
+    }
+    if (fclose(out) != 0)
+	unix_error(argv[2]);
+    free(recs);
+    free(table);
+    free(id_bytes);
+    free(free_ids);
+    free(ops);
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * rep2bin.c - Convert a text .rep trace into the binary trace format
+ *             described in bintrace.h
+ *
+ * Usage: rep2bin <in.rep> <out.bin>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bintrace.h"
+
+static void unix_error(const char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+static void app_error(const char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+/*
+ * put_op - Append one request to the binary trace
+ */
+static void put_op(FILE *out, int type, unsigned int index,
+		   unsigned int arg, unsigned int size)
+{
+    unsigned char buf[1 + 3*BT_MAXVARINT];
+    size_t n = 0;
+
+    buf[n++] = (unsigned char)type;
+    n += bt_put_varint(buf + n, index);
+    if (type == BT_MEMALIGN || type == BT_CALLOC ||
+	type == BT_ALLOC_BATCH || type == BT_FREE_BATCH)
+	n += bt_put_varint(buf + n, arg);
+    if (type != BT_FREE && type != BT_FREE_BATCH)
+	n += bt_put_varint(buf + n, size);
+    if (fwrite(buf, 1, n, out) != n)
+	unix_error("fwrite of request");
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    bt_header_t hdr;
+    char type[1024];
+    unsigned int index, arg, size;
+    unsigned int num_ops = 0;
+
+    if (argc != 3) {
+	fprintf(stderr, "Usage: %s <in.rep> <out.bin>\n", argv[0]);
+	exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL)
+	unix_error(argv[1]);
+    if ((out = fopen(argv[2], "wb")) == NULL)
+	unix_error(argv[2]);
+
+    /* The header fields keep the order they have in a .rep file */
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BT_MAGIC, sizeof(hdr.magic));
+    hdr.version = BT_VERSION;
+    if (fscanf(in, "%u %u %u %u", &hdr.sugg_heapsize, &hdr.num_ids,
+	       &hdr.num_ops, &hdr.weight) != 4)
+	app_error("fscanf of trace header");
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+	unix_error("fwrite of header");
+
+    while (fscanf(in, "%s", type) != EOF) {
+	arg = 0;
+	switch (type[0]) {
+	case BT_ALLOC:
+	case BT_REALLOC:
+	    if (fscanf(in, "%u %u", &index, &size) != 2)
+		app_error("fscanf of allocation");
+	    break;
+	case BT_FREE:
+	    if (fscanf(in, "%u", &index) != 1)
+		app_error("fscanf of free");
+	    size = 0;
+	    break;
+	case BT_MEMALIGN:
+	case BT_CALLOC:
+	case BT_ALLOC_BATCH:
+	    if (fscanf(in, "%u %u %u", &index, &arg, &size) != 3)
+		app_error("fscanf of memalign, calloc or batch allocation");
+	    break;
+	case BT_FREE_BATCH:
+	    if (fscanf(in, "%u %u", &index, &arg) != 2)
+		app_error("fscanf of batch free");
+	    size = 0;
+	    break;
+	default:
+	    fprintf(stderr, "Bogus type character (%c) in %s\n",
+		    type[0], argv[1]);
+	    exit(1);
+	}
+	if (index >= hdr.num_ids ||
+	    ((type[0] == BT_ALLOC_BATCH || type[0] == BT_FREE_BATCH) &&
+	     (arg == 0 || arg > hdr.num_ids - index)))
+	    app_error("block index out of range");
+	put_op(out, type[0], index, arg, size);
+	num_ops++;
+    }
+    if (num_ops != hdr.num_ops)
+	app_error("number of requests does not match the header");
+
+    fclose(in);
+    if (fclose(out) != 0)
+	unix_error(argv[2]);
+    return 0;
+}